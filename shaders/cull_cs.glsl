@@ -0,0 +1,150 @@
+#version 430
+
+layout(local_size_x = 64) in;
+
+//These match the structs in GpuDrivenRenderer.hpp
+struct InstanceData
+{
+	mat4 model;
+	vec4 bounds;
+	uint mesh_index;
+	uint material_index;
+	uint command_offset;
+	float uv_density;
+	uint baked_offset;
+};
+
+struct MeshData
+{
+	uint first_index;
+	uint index_count;
+	int base_vertex;
+	uint pad;
+};
+
+struct DrawCommand
+{
+	uint count;
+	uint instance_count;
+	uint first_index;
+	int base_vertex;
+	uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { InstanceData instances[]; };
+layout(std430, binding = 1) readonly buffer Meshes { MeshData meshes[]; };
+layout(std430, binding = 2) writeonly buffer Commands { DrawCommand commands[]; };
+//one count per material followed by the total
+layout(std430, binding = 3) buffer Counts { uint counts[]; };
+//float bits of the smallest texels per pixel of each material
+layout(std430, binding = 4) buffer Demand { uint demand[]; };
+
+uniform uint instance_count;
+uniform uint material_count;
+uniform vec4 frustum_planes[6];
+uniform vec3 camera_position;
+uniform float near_plane;
+uniform float pixels_per_unit;
+
+uniform bool occlusion_enabled;
+uniform mat4 pyramid_view_projection;
+uniform sampler2D depth_pyramid;
+uniform int pyramid_levels;
+
+bool isInsideFrustum(vec3 centre, float radius)
+{
+	for (int i = 0; i < 6; i++)
+	{
+		if (dot(frustum_planes[i].xyz, centre) + frustum_planes[i].w < -radius)
+			return false;
+	}
+	return true;
+}
+
+//Tests the box around the bounding sphere against the depth pyramid built
+//from the previous frame, anything crossing the near plane counts as visible
+bool isOccluded(vec3 centre, float radius)
+{
+	vec3 ndc_min = vec3(1.0);
+	vec3 ndc_max = vec3(-1.0);
+	for (int i = 0; i < 8; i++)
+	{
+		vec3 corner = centre + radius * vec3((i & 1) != 0 ? 1.0 : -1.0,
+			(i & 2) != 0 ? 1.0 : -1.0, (i & 4) != 0 ? 1.0 : -1.0);
+		vec4 clip = pyramid_view_projection * vec4(corner, 1.0);
+		if (clip.w <= 0.0)
+			return false;
+		vec3 ndc = clip.xyz / clip.w;
+		ndc_min = min(ndc_min, ndc);
+		ndc_max = max(ndc_max, ndc);
+	}
+
+	vec2 uv_min = clamp(ndc_min.xy * 0.5 + 0.5, 0.0, 1.0);
+	vec2 uv_max = clamp(ndc_max.xy * 0.5 + 0.5, 0.0, 1.0);
+	float closest_depth = ndc_min.z * 0.5 + 0.5;
+
+	//pick the level where the box covers at most two texels in each direction
+	vec2 size = vec2(textureSize(depth_pyramid, 0));
+	vec2 extent = (uv_max - uv_min) * size;
+	int level = int(ceil(log2(max(max(extent.x, extent.y), 1.0))));
+	level = clamp(level, 0, pyramid_levels - 1);
+
+	//the pyramid halves rounding down and folds odd remainders into the last
+	//texel, so a texel covers 2^level pixels of level zero except the last one
+	//in each row and column, which covers the rest. Scaling uv by the level
+	//size would miss that, so go through level zero pixels instead
+	ivec2 size0 = textureSize(depth_pyramid, 0);
+	ivec2 pixel_min = clamp(ivec2(uv_min * size), ivec2(0), size0 - 1);
+	ivec2 pixel_max = clamp(ivec2(uv_max * size), ivec2(0), size0 - 1);
+
+	//the level size follows from level zero the same way glTexStorage2D
+	//works it out, textureSize with a level that differs between invocations
+	//isn't reliable everywhere (llvmpipe answers with one of them)
+	ivec2 last_texel = max(size0 >> level, ivec2(1)) - 1;
+	ivec2 texel_min = min(pixel_min >> level, last_texel);
+	ivec2 texel_max = min(pixel_max >> level, last_texel);
+
+	float furthest_depth = max(
+		max(texelFetch(depth_pyramid, texel_min, level).r,
+			texelFetch(depth_pyramid, ivec2(texel_max.x, texel_min.y), level).r),
+		max(texelFetch(depth_pyramid, ivec2(texel_min.x, texel_max.y), level).r,
+			texelFetch(depth_pyramid, texel_max, level).r));
+
+	return closest_depth > furthest_depth;
+}
+
+void main(void)
+{
+	uint id = gl_GlobalInvocationID.x;
+	if (id >= instance_count)
+		return;
+
+	InstanceData instance = instances[id];
+
+	vec3 centre = (instance.model * vec4(instance.bounds.xyz, 1.0)).xyz;
+	float scale = max(length(instance.model[0].xyz),
+		max(length(instance.model[1].xyz), length(instance.model[2].xyz)));
+	float radius = instance.bounds.w * scale;
+
+	if (!isInsideFrustum(centre, radius))
+		return;
+	if (occlusion_enabled && isOccluded(centre, radius))
+		return;
+
+	//same mip selection as the CPU path, the texture size is applied on the CPU
+	float distance = max(near_plane, distance(centre, camera_position) - radius);
+	float texels_per_pixel = instance.uv_density / scale * distance / pixels_per_unit;
+	atomicMin(demand[instance.material_index], floatBitsToUint(texels_per_pixel));
+
+	uint slot = atomicAdd(counts[instance.material_index], 1u);
+	atomicAdd(counts[material_count], 1u);
+
+	MeshData mesh = meshes[instance.mesh_index];
+	DrawCommand command;
+	command.count = mesh.index_count;
+	command.instance_count = 1u;
+	command.first_index = mesh.first_index;
+	command.base_vertex = mesh.base_vertex;
+	command.base_instance = id;
+	commands[instance.command_offset + slot] = command;
+}
@@ -0,0 +1,44 @@
+#version 430
+
+layout(local_size_x = 8, local_size_y = 8) in;
+
+layout(r32f, binding = 0) uniform readonly image2D source_level;
+layout(r32f, binding = 1) uniform writeonly image2D target_level;
+
+//Level zero copies the depth buffer, after that each texel keeps the
+//furthest depth of the texels it covers in the level above
+uniform bool copy_depth;
+uniform sampler2D depth_sampler;
+
+void main(void)
+{
+	ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+	ivec2 target_size = imageSize(target_level);
+	if (any(greaterThanEqual(texel, target_size)))
+		return;
+
+	if (copy_depth)
+	{
+		imageStore(target_level, texel, vec4(texelFetch(depth_sampler, texel, 0).r));
+		return;
+	}
+
+	ivec2 source_size = imageSize(source_level);
+	ivec2 source_texel = texel * 2;
+
+	//an odd sized source has a row or column that would otherwise be missed,
+	//the last texel picks it up
+	ivec2 last = min(source_texel + ivec2(1), source_size - 1);
+	if (texel.x == target_size.x - 1 && (source_size.x & 1) != 0)
+		last.x = source_size.x - 1;
+	if (texel.y == target_size.y - 1 && (source_size.y & 1) != 0)
+		last.y = source_size.y - 1;
+
+	float furthest = 0.0;
+	for (int y = source_texel.y; y <= last.y; y++)
+	{
+		for (int x = source_texel.x; x <= last.x; x++)
+			furthest = max(furthest, imageLoad(source_level, ivec2(x, y)).r);
+	}
+	imageStore(target_level, texel, vec4(furthest));
+}
@@ -0,0 +1,12 @@
+#version 330
+
+uniform sampler2D frame_sampler;
+
+in vec2 UV;
+
+out vec4 fragment_colour;
+
+void main(void)
+{
+	fragment_colour = texture(frame_sampler, UV);
+}
@@ -0,0 +1,11 @@
+#version 330
+
+out vec2 UV;
+
+//Draws a single triangle covering the whole screen without any vertex data
+void main(void)
+{
+	vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	UV = position;
+	gl_Position = vec4(position * 2.0 - 1.0, 0.0, 1.0);
+}
@@ -26,11 +26,14 @@ out vec4 fragment_colour;
 in vec3 vNormal;
 in vec3 FragPos;
 in vec2 UV;
+in vec3 BakedIrradiance;
 
 uniform Light Lights[24];
 uniform Material mat;
 uniform vec3 cameraPos;
 uniform vec3 ambientIntensityColour;
+//when set the diffuse light of the point lights comes from BakedIrradiance
+uniform bool baked_lighting;
 
 //Specular phone function gets the specular colour
 //The reason it is abstracted is because multiple light casters need the specular
@@ -72,6 +75,16 @@ vec3 PointLight(Light light, vec3 N, vec3 SurfaceColour)
 	return vec3(light.intensity * (diffusePhong + specularPhong)) * attenuation;
 }
 
+//Only the specular part of a point light, used when its diffuse is baked
+vec3 PointLightSpecular(Light light, vec3 N)
+{
+	vec3 L = normalize(light.position - FragPos);
+	float lightDistance = distance(light.position, FragPos);
+	float attenuation = smoothstep(light.range, light.range/2, lightDistance);
+
+	return light.intensity * SpecularPhong(mat, L, N) * attenuation;
+}
+
 vec3 SpotLight(Light light, vec3 N, vec3 SurfaceColour)
 {
 	vec3 L = normalize(light.position - FragPos);
@@ -125,17 +138,28 @@ void main(void)
 	vec3 ambientLight = (ambientIntensityColour * mat.ambient_colour * SurfaceColour);
 	vec3 finalColour = ambientLight;
 
-	for (int i = 0; i < 24; i++)
+	//with their diffuse baked the point lights only add specular, which a
+	//material without shininess doesn't have, so it starts at the spot light
+	int first_light = 0;
+	if (baked_lighting && mat.shininess <= 0)
+		first_light = 22;
+
+	for (int i = first_light; i < 24; i++)
 	{
 		if (i == 23)
 			finalColour += DirectionalLight(Lights[i], N, SurfaceColour);
 		if (i == 22)
 			finalColour += SpotLight(Lights[i], N, SurfaceColour);
+		else if (baked_lighting && i < 22)
+			finalColour += PointLightSpecular(Lights[i], N);
 		else
 		{
 			finalColour += PointLight(Lights[i], N, SurfaceColour);
 		}
 	}
 
+	if (baked_lighting)
+		finalColour += SurfaceColour * BakedIrradiance;
+
 	fragment_colour = vec4(finalColour, 1.0);
 }
@@ -0,0 +1,56 @@
+#version 430
+
+//Vertex shader for the GPU driven path, the model matrix comes from the same
+//storage buffer the cull shader read it from
+
+struct InstanceData
+{
+	mat4 model;
+	vec4 bounds;
+	uint mesh_index;
+	uint material_index;
+	uint command_offset;
+	float uv_density;
+	uint baked_offset;
+};
+
+struct MeshData
+{
+	uint first_index;
+	uint index_count;
+	int base_vertex;
+	uint pad;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { InstanceData instances[]; };
+layout(std430, binding = 1) readonly buffer Meshes { MeshData meshes[]; };
+
+uniform mat4 view_projection_xform;
+
+uniform bool baked_lighting;
+uniform samplerBuffer baked_irradiance_sampler;
+
+in vec3 vertex_position;
+in vec3 vertex_normal;
+in vec2 vertex_uv;
+//base_instance of the draw command, the attribute has a divisor of one
+in uint instance_index;
+
+out vec3 vNormal;
+out vec3 FragPos;
+out vec2 UV;
+out vec3 BakedIrradiance;
+
+void main(void)
+{
+	InstanceData instance = instances[instance_index];
+	mat4 model_xform = instance.model;
+	vNormal = mat3(model_xform) * vertex_normal;
+	FragPos = mat4x3(model_xform) * vec4(vertex_position, 1.0);
+	UV = vertex_uv;
+	//gl_VertexID includes the base vertex of the shared vertex buffer
+	int vertex = gl_VertexID - meshes[instance.mesh_index].base_vertex;
+	BakedIrradiance = baked_lighting
+		? texelFetch(baked_irradiance_sampler, int(instance.baked_offset) + vertex).rgb : vec3(0.0);
+	gl_Position = view_projection_xform * vec4(FragPos, 1.0);
+}
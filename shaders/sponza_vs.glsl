@@ -5,6 +5,12 @@ uniform mat4 projection_xform;
 uniform mat4 view_xform;
 uniform mat4 model_xform;
 
+//Diffuse light of the static point lights baked per vertex, baked_offset is
+//where this instance's vertices start
+uniform bool baked_lighting;
+uniform samplerBuffer baked_irradiance_sampler;
+uniform int baked_offset;
+
 in vec3 vertex_position;
 in vec3 vertex_normal;
 in vec3 vertex_tangent;
@@ -13,11 +19,14 @@ in vec2 vertex_uv;
 out vec3 vNormal;
 out vec3 FragPos;
 out vec2 UV;
+out vec3 BakedIrradiance;
 
 void main(void)
 {
 	vNormal = mat3(model_xform) * vertex_normal;
 	FragPos = mat4x3(model_xform) * vec4(vertex_position, 1.0);
 	UV = vertex_uv;
+	BakedIrradiance = baked_lighting
+		? texelFetch(baked_irradiance_sampler, baked_offset + gl_VertexID).rgb : vec3(0.0);
 	gl_Position = projection_view_model_xform * vec4(vertex_position, 1.0);
 }
@@ -0,0 +1,93 @@
+#include "AllocationTracker.hpp"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef SPONZA_TRACK_ALLOCATIONS
+
+static thread_local std::uint64_t thread_allocation_count = 0;
+
+static void * trackedAllocate(std::size_t size)
+{
+	thread_allocation_count++;
+	void * memory = std::malloc(size > 0 ? size : 1);
+	if (memory == nullptr)
+		throw std::bad_alloc();
+	return memory;
+}
+
+void * operator new(std::size_t size)
+{
+	return trackedAllocate(size);
+}
+
+void * operator new[](std::size_t size)
+{
+	return trackedAllocate(size);
+}
+
+void * operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	thread_allocation_count++;
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void * operator new[](std::size_t size, const std::nothrow_t &) noexcept
+{
+	thread_allocation_count++;
+	return std::malloc(size > 0 ? size : 1);
+}
+
+void operator delete(void * memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void * memory) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void * memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void * memory, std::size_t) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete(void * memory, const std::nothrow_t &) noexcept
+{
+	std::free(memory);
+}
+
+void operator delete[](void * memory, const std::nothrow_t &) noexcept
+{
+	std::free(memory);
+}
+
+bool AllocationTracker::isEnabled()
+{
+	return true;
+}
+
+std::uint64_t AllocationTracker::threadAllocationCount()
+{
+	return thread_allocation_count;
+}
+
+#else
+
+bool AllocationTracker::isEnabled()
+{
+	return false;
+}
+
+std::uint64_t AllocationTracker::threadAllocationCount()
+{
+	return 0;
+}
+
+#endif
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <cstdint>
+
+// Counts heap allocations made through operator new on the calling thread.
+// Counting only happens in the instrumented configuration, builds with
+// SPONZA_TRACK_ALLOCATIONS defined for every translation unit, which replaces
+// the global operator new. Otherwise the count stays zero.
+// tests/CMakeLists.txt sets it up as the sponza_allocation_tracking target.
+class AllocationTracker
+{
+public:
+
+	static bool isEnabled();
+
+	static std::uint64_t threadAllocationCount();
+};
@@ -0,0 +1,44 @@
+#pragma once
+
+#include "FrameArena.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+// One entry per visible instance, built fresh every frame
+struct DrawItem
+{
+	std::uint64_t sort_key;
+	std::uint32_t instance_index;
+	int mesh_index;
+	int material_index;
+};
+
+typedef FrameVector<DrawItem> DrawList;
+
+// Builds a frame's draw list from instance_count instances. accept gets an
+// item with its instance_index set, fills in the mesh and material index
+// and returns false if the instance isn't drawn.
+// Sorting by mesh then material means vertex arrays and materials are only
+// bound when they actually change. Once the arena behind the list has grown
+// to fit, none of this touches the heap.
+template<typename Accept>
+void buildDrawList(DrawList & draw_list, std::size_t instance_count, Accept accept)
+{
+	draw_list.clear();
+	draw_list.reserve(instance_count);
+	for (std::size_t i = 0; i < instance_count; i++)
+	{
+		DrawItem item;
+		item.instance_index = (std::uint32_t)i;
+		if (!accept(item))
+			continue;
+		item.sort_key = ((std::uint64_t)(std::uint32_t)item.mesh_index << 32)
+			| (std::uint32_t)item.material_index;
+		draw_list.push_back(item);
+	}
+
+	std::sort(draw_list.begin(), draw_list.end(),
+		[](const DrawItem& a, const DrawItem& b) { return a.sort_key < b.sort_key; });
+}
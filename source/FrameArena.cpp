@@ -0,0 +1,68 @@
+#include "FrameArena.hpp"
+
+#include <cstdint>
+
+// The arena's own memory goes through operator new like everything else, so
+// an arena that keeps spilling shows up in AllocationTracker's counts
+static void * heapAllocate(std::size_t bytes)
+{
+	return ::operator new(bytes);
+}
+
+static void heapFree(void * memory)
+{
+	::operator delete(memory);
+}
+
+FrameArena::FrameArena(std::size_t capacity) : capacity_(capacity)
+{
+	buffer_ = static_cast<char *>(heapAllocate(capacity_));
+	heap_allocations_++;
+}
+
+FrameArena::~FrameArena()
+{
+	for (void * memory : overflow_)
+		heapFree(memory);
+	heapFree(buffer_);
+}
+
+void * FrameArena::allocate(std::size_t bytes, std::size_t alignment)
+{
+	const std::uintptr_t base = reinterpret_cast<std::uintptr_t>(buffer_);
+	const std::uintptr_t aligned = (base + used_ + alignment - 1) & ~(std::uintptr_t)(alignment - 1);
+	const std::size_t end = (std::size_t)(aligned - base) + bytes;
+	if (end <= capacity_)
+	{
+		used_ = end;
+		return reinterpret_cast<void *>(aligned);
+	}
+
+	//out of space, this frame gets heap memory and reset() grows the buffer
+	void * memory = heapAllocate(bytes + alignment);
+	heap_allocations_++;
+	overflow_.push_back(memory);
+	overflow_bytes_ += bytes + alignment;
+	const std::uintptr_t overflow_aligned = (reinterpret_cast<std::uintptr_t>(memory) + alignment - 1)
+		& ~(std::uintptr_t)(alignment - 1);
+	return reinterpret_cast<void *>(overflow_aligned);
+}
+
+void FrameArena::reset()
+{
+	if (!overflow_.empty())
+	{
+		for (void * memory : overflow_)
+			heapFree(memory);
+		overflow_.clear();
+
+		capacity_ = (capacity_ + overflow_bytes_) * 2;
+		//cleared first so a failed allocation doesn't leave it dangling
+		heapFree(buffer_);
+		buffer_ = nullptr;
+		buffer_ = static_cast<char *>(heapAllocate(capacity_));
+		heap_allocations_++;
+		overflow_bytes_ = 0;
+	}
+	used_ = 0;
+}
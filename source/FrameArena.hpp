@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <vector>
+
+// Bump allocator for data that only lives for one frame, e.g. draw lists and
+// culling results. Allocating is a pointer increment and reset() throws
+// everything away at once.
+// If a frame needs more than the capacity the extra comes from the heap and
+// the next reset() grows the buffer to fit, so after a few frames the arena
+// stops touching the heap altogether.
+class FrameArena
+{
+public:
+
+	explicit FrameArena(std::size_t capacity);
+
+	~FrameArena();
+
+	FrameArena(const FrameArena &) = delete;
+	FrameArena & operator=(const FrameArena &) = delete;
+
+	void * allocate(std::size_t bytes, std::size_t alignment);
+
+	void reset();
+
+	std::size_t capacity() const { return capacity_; }
+
+	std::size_t bytesUsed() const { return used_ + overflow_bytes_; }
+
+	// Times the arena went to the heap, for its buffer or for overflow. Once
+	// warmed up this should stop changing.
+	std::uint64_t heapAllocations() const { return heap_allocations_; }
+
+private:
+
+	char * buffer_{ nullptr };
+	std::size_t capacity_{ 0 };
+	std::size_t used_{ 0 };
+
+	std::vector<void *> overflow_;
+	std::size_t overflow_bytes_{ 0 };
+	std::uint64_t heap_allocations_{ 0 };
+};
+
+// Lets standard containers allocate from a FrameArena, deallocate does
+// nothing as the memory goes away on the next reset
+template<typename T>
+class FrameAllocator
+{
+public:
+
+	typedef T value_type;
+
+	explicit FrameAllocator(FrameArena & arena) : arena_(&arena) {}
+
+	template<typename U>
+	FrameAllocator(const FrameAllocator<U> & other) : arena_(other.arena()) {}
+
+	T * allocate(std::size_t count)
+	{
+		return static_cast<T *>(arena_->allocate(count * sizeof(T), alignof(T)));
+	}
+
+	void deallocate(T *, std::size_t) {}
+
+	FrameArena * arena() const { return arena_; }
+
+private:
+
+	FrameArena * arena_;
+};
+
+template<typename T, typename U>
+bool operator==(const FrameAllocator<T> & a, const FrameAllocator<U> & b)
+{
+	return a.arena() == b.arena();
+}
+
+template<typename T, typename U>
+bool operator!=(const FrameAllocator<T> & a, const FrameAllocator<U> & b)
+{
+	return !(a == b);
+}
+
+template<typename T>
+using FrameVector = std::vector<T, FrameAllocator<T>>;
@@ -0,0 +1,15 @@
+#pragma once
+
+// Tests a bounding sphere against six frustum planes that point inwards,
+// the same rule cull_cs.glsl applies on the GPU. Planes need x, y, z and w
+// and the centre x, y and z, so glm types and plain structs both work.
+template <typename Plane, typename Point>
+inline bool isInsideFrustum(const Plane (&planes)[6], const Point & centre, float radius)
+{
+	for (const auto& plane : planes)
+	{
+		if (plane.x * centre.x + plane.y * centre.y + plane.z * centre.z + plane.w < -radius)
+			return false;
+	}
+	return true;
+}
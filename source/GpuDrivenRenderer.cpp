@@ -0,0 +1,484 @@
+#include "GpuDrivenRenderer.hpp"
+
+#include <tygra/FileHelper.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <limits>
+
+// Binding points shared with cull_cs.glsl and sponza_gpu_vs.glsl
+enum StorageBindings {
+	kInstanceBinding = 0,
+	kMeshBinding = 1,
+	kCommandBinding = 2,
+	kCountBinding = 3,
+	kDemandBinding = 4
+};
+
+static const int kCullGroupSize = 64;
+static const int kPyramidGroupSize = 8;
+
+// Marks a material that had no visible instance in the demand buffer
+static const std::uint32_t kNoDemand = 0xFFFFFFFFu;
+
+static bool hasExtension(const char * name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		const char * extension = (const char *)glGetStringi(GL_EXTENSIONS, i);
+		if (extension != nullptr && std::strcmp(extension, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static void getVersion(GLint & major, GLint & minor)
+{
+	major = 0;
+	minor = 0;
+	glGetIntegerv(GL_MAJOR_VERSION, &major);
+	glGetIntegerv(GL_MINOR_VERSION, &minor);
+}
+
+bool GpuDrivenRenderer::isSupported()
+{
+	GLint major, minor;
+	getVersion(major, minor);
+	return major > 4 || (major == 4 && minor >= 3);
+}
+
+GpuDrivenRenderer::GpuDrivenRenderer()
+{
+}
+
+GpuDrivenRenderer::~GpuDrivenRenderer()
+{
+}
+
+bool GpuDrivenRenderer::start(int material_count)
+{
+	material_count_ = material_count;
+
+	cull_program_ = createComputeProgram("resource:///cull_cs.glsl");
+	pyramid_program_ = createComputeProgram("resource:///depth_pyramid_cs.glsl");
+	if (cull_program_ == 0 || pyramid_program_ == 0)
+		return false;
+
+	cull_instance_count_ = glGetUniformLocation(cull_program_, "instance_count");
+	cull_material_count_ = glGetUniformLocation(cull_program_, "material_count");
+	cull_frustum_planes_ = glGetUniformLocation(cull_program_, "frustum_planes");
+	cull_camera_position_ = glGetUniformLocation(cull_program_, "camera_position");
+	cull_near_plane_ = glGetUniformLocation(cull_program_, "near_plane");
+	cull_pixels_per_unit_ = glGetUniformLocation(cull_program_, "pixels_per_unit");
+	cull_occlusion_enabled_ = glGetUniformLocation(cull_program_, "occlusion_enabled");
+	cull_pyramid_view_projection_ = glGetUniformLocation(cull_program_, "pyramid_view_projection");
+	cull_depth_pyramid_ = glGetUniformLocation(cull_program_, "depth_pyramid");
+	cull_pyramid_levels_ = glGetUniformLocation(cull_program_, "pyramid_levels");
+	pyramid_copy_depth_ = glGetUniformLocation(pyramid_program_, "copy_depth");
+	pyramid_depth_sampler_ = glGetUniformLocation(pyramid_program_, "depth_sampler");
+
+	//Drawing with the count the cull shader wrote needs ARB_indirect_parameters
+	//(core in 4.6, where drivers still list the extension). Without it every
+	//command slot of a material is drawn and the unused ones are left with an
+	//instance count of zero.
+#ifdef GL_ARB_indirect_parameters
+	has_indirect_count_ = hasExtension("GL_ARB_indirect_parameters");
+#endif
+	std::cout << "GPU driven rendering: "
+		<< (has_indirect_count_ ? "using indirect count" : "using multi draw indirect fallback")
+		<< std::endl;
+
+	glGenBuffers(1, &instance_ssbo_);
+	glGenBuffers(1, &mesh_ssbo_);
+	glGenBuffers(1, &command_buffer_);
+	glGenBuffers(1, &count_buffer_);
+	glGenBuffers(2, demand_buffers_);
+
+	//one draw count per material followed by the total
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, count_buffer_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, (material_count_ + 1) * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_DRAW);
+	for (GLuint buffer : demand_buffers_)
+	{
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, material_count_ * sizeof(std::uint32_t), nullptr, GL_DYNAMIC_READ);
+	}
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	material_offsets_.assign(material_count_, 0);
+	material_sizes_.assign(material_count_, 0);
+	demand_bits_.assign(material_count_, kNoDemand);
+	material_demand_.assign(material_count_, std::numeric_limits<float>::infinity());
+	return true;
+}
+
+void GpuDrivenRenderer::stop()
+{
+	for (GLsync& fence : demand_fences_)
+	{
+		if (fence != nullptr)
+			glDeleteSync(fence);
+		fence = nullptr;
+	}
+	glDeleteBuffers(2, demand_buffers_);
+	glDeleteBuffers(1, &count_buffer_);
+	glDeleteBuffers(1, &command_buffer_);
+	glDeleteBuffers(1, &mesh_ssbo_);
+	glDeleteBuffers(1, &instance_ssbo_);
+	glDeleteBuffers(1, &instance_id_vbo_);
+	glDeleteBuffers(1, &element_vbo_);
+	glDeleteBuffers(1, &vertex_vbo_);
+	glDeleteVertexArrays(1, &vao_);
+	glDeleteTextures(1, &depth_pyramid_);
+	glDeleteProgram(cull_program_);
+	glDeleteProgram(pyramid_program_);
+	cull_program_ = 0;
+	pyramid_program_ = 0;
+	depth_pyramid_ = 0;
+	pyramid_valid_ = false;
+	instance_count_ = 0;
+	instance_capacity_ = 0;
+}
+
+int GpuDrivenRenderer::addMesh(const void * vertices, int vertex_count, int vertex_size,
+	const unsigned int * elements, int element_count, const MeshInfo & info)
+{
+	GpuMesh mesh;
+	mesh.first_index = (std::uint32_t)element_data_.size();
+	mesh.index_count = (std::uint32_t)element_count;
+	mesh.base_vertex = (std::int32_t)(vertex_data_.size() / vertex_size);
+	mesh.pad = 0;
+
+	const unsigned char * bytes = static_cast<const unsigned char *>(vertices);
+	vertex_data_.insert(vertex_data_.end(), bytes, bytes + vertex_count * vertex_size);
+	element_data_.insert(element_data_.end(), elements, elements + element_count);
+
+	meshes_.push_back(mesh);
+	mesh_infos_.push_back(info);
+	return (int)meshes_.size() - 1;
+}
+
+GLuint GpuDrivenRenderer::finishGeometry(GLuint instance_attribute)
+{
+	glGenBuffers(1, &vertex_vbo_);
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, vertex_data_.size(), vertex_data_.data(), GL_STATIC_DRAW);
+
+	glGenBuffers(1, &element_vbo_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo_);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, element_data_.size() * sizeof(unsigned int),
+		element_data_.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mesh_ssbo_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, meshes_.size() * sizeof(GpuMesh), meshes_.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	//the cpu copies are no longer needed
+	std::vector<unsigned char>().swap(vertex_data_);
+	std::vector<unsigned int>().swap(element_data_);
+
+	//each draw command puts its instance index in base_instance, with a
+	//divisor of one that is what this attribute fetches
+	glGenBuffers(1, &instance_id_vbo_);
+
+	glGenVertexArrays(1, &vao_);
+	glBindVertexArray(vao_);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo_);
+
+	glBindBuffer(GL_ARRAY_BUFFER, instance_id_vbo_);
+	glEnableVertexAttribArray(instance_attribute);
+	glVertexAttribIPointer(instance_attribute, 1, GL_UNSIGNED_INT, sizeof(std::uint32_t), 0);
+	glVertexAttribDivisor(instance_attribute, 1);
+
+	glBindBuffer(GL_ARRAY_BUFFER, vertex_vbo_);
+	return vao_;
+}
+
+void GpuDrivenRenderer::setInstances(const std::vector<Instance> & instances)
+{
+	instance_count_ = (int)instances.size();
+
+	//each material gets a range of the command buffer big enough for all of
+	//its instances
+	std::fill(material_sizes_.begin(), material_sizes_.end(), 0u);
+	for (const auto& instance : instances)
+		material_sizes_[instance.material_index]++;
+	std::uint32_t offset = 0;
+	for (int i = 0; i < material_count_; i++)
+	{
+		material_offsets_[i] = offset;
+		offset += material_sizes_[i];
+	}
+
+	gpu_instances_.resize(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		const Instance& instance = instances[i];
+		const MeshInfo& info = mesh_infos_[instance.mesh_index];
+		GpuInstance& gpu_instance = gpu_instances_[i];
+		gpu_instance.model = glm::mat4(instance.xform);
+		gpu_instance.bounds = glm::vec4(info.bounds_centre, info.bounds_radius);
+		gpu_instance.mesh_index = instance.mesh_index;
+		gpu_instance.material_index = instance.material_index;
+		gpu_instance.command_offset = material_offsets_[instance.material_index];
+		gpu_instance.uv_density = info.uv_density;
+		gpu_instance.baked_offset = instance.baked_offset;
+		gpu_instance.pad[0] = gpu_instance.pad[1] = gpu_instance.pad[2] = 0;
+	}
+
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, instance_ssbo_);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, gpu_instances_.size() * sizeof(GpuInstance),
+		gpu_instances_.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	//the command buffer and the instance ids only have to grow, the ids are
+	//just 0 to n - 1 so a longer buffer serves fewer instances too
+	if (instance_capacity_ > 0 && instances.size() <= instance_capacity_)
+		return;
+	instance_capacity_ = std::max<size_t>(1, instances.size());
+
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+	glBufferData(GL_DRAW_INDIRECT_BUFFER, instance_capacity_ * sizeof(DrawCommand),
+		nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+
+	std::vector<std::uint32_t> instance_ids(instance_capacity_);
+	for (size_t i = 0; i < instance_ids.size(); i++)
+		instance_ids[i] = (std::uint32_t)i;
+	glBindBuffer(GL_ARRAY_BUFFER, instance_id_vbo_);
+	glBufferData(GL_ARRAY_BUFFER, instance_ids.size() * sizeof(std::uint32_t),
+		instance_ids.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void GpuDrivenRenderer::resize(int width, int height)
+{
+	//the pyramid has immutable storage so it is recreated at the new size
+	glDeleteTextures(1, &depth_pyramid_);
+
+	pyramid_width_ = width;
+	pyramid_height_ = height;
+	pyramid_levels_ = 1;
+	while ((width >> pyramid_levels_) > 0 || (height >> pyramid_levels_) > 0)
+		pyramid_levels_++;
+
+	glGenTextures(1, &depth_pyramid_);
+	glBindTexture(GL_TEXTURE_2D, depth_pyramid_);
+	glTexStorage2D(GL_TEXTURE_2D, pyramid_levels_, GL_R32F, width, height);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	pyramid_valid_ = false;
+}
+
+void GpuDrivenRenderer::cull(const CullParameters & parameters, bool occlusion)
+{
+	pollMaterialDemand();
+
+	const int write_index = frame_index_ & 1;
+	frame_index_++;
+
+	//counts start at zero and the commands are zeroed so the fallback path
+	//draws nothing for the slots no instance was written to
+	const std::uint32_t zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, count_buffer_);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, command_buffer_);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, demand_buffers_[write_index]);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &kNoDemand);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	if (instance_count_ > 0)
+	{
+		glUseProgram(cull_program_);
+		glUniform1ui(cull_instance_count_, instance_count_);
+		glUniform1ui(cull_material_count_, material_count_);
+		glUniform4fv(cull_frustum_planes_, 6, glm::value_ptr(parameters.frustum_planes[0]));
+		glUniform3fv(cull_camera_position_, 1, glm::value_ptr(parameters.camera_position));
+		glUniform1f(cull_near_plane_, parameters.near_plane);
+		glUniform1f(cull_pixels_per_unit_, parameters.pixels_per_unit);
+
+		const bool use_pyramid = occlusion && pyramid_valid_;
+		glUniform1i(cull_occlusion_enabled_, use_pyramid);
+		glUniformMatrix4fv(cull_pyramid_view_projection_, 1, GL_FALSE, glm::value_ptr(pyramid_view_projection_));
+		glUniform1i(cull_pyramid_levels_, pyramid_levels_);
+		glUniform1i(cull_depth_pyramid_, 0);
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, depth_pyramid_);
+
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kInstanceBinding, instance_ssbo_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMeshBinding, mesh_ssbo_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCommandBinding, command_buffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kCountBinding, count_buffer_);
+		glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kDemandBinding, demand_buffers_[write_index]);
+
+		glDispatchCompute((instance_count_ + kCullGroupSize - 1) / kCullGroupSize, 1, 1);
+
+		glBindTexture(GL_TEXTURE_2D, 0);
+	}
+
+	//the commands and counts are consumed by the draws, the demand is read
+	//back once its fence has passed
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_SHADER_STORAGE_BARRIER_BIT
+		| GL_BUFFER_UPDATE_BARRIER_BIT);
+
+	if (demand_fences_[write_index] != nullptr)
+		glDeleteSync(demand_fences_[write_index]);
+	demand_fences_[write_index] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void GpuDrivenRenderer::bindGeometry()
+{
+	glBindVertexArray(vao_);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, command_buffer_);
+#ifdef GL_ARB_indirect_parameters
+	if (has_indirect_count_)
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, count_buffer_);
+#endif
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kInstanceBinding, instance_ssbo_);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, kMeshBinding, mesh_ssbo_);
+}
+
+void GpuDrivenRenderer::drawMaterial(int material_index)
+{
+	const GLsizei max_draws = material_sizes_[material_index];
+	if (max_draws == 0)
+		return;
+
+	const void * commands = (const void *)(std::uintptr_t)(material_offsets_[material_index] * sizeof(DrawCommand));
+	const GLintptr draw_count = material_index * sizeof(std::uint32_t);
+
+#ifdef GL_ARB_indirect_parameters
+	if (has_indirect_count_)
+	{
+		glMultiDrawElementsIndirectCountARB(GL_TRIANGLES, GL_UNSIGNED_INT, commands,
+			draw_count, max_draws, sizeof(DrawCommand));
+		return;
+	}
+#endif
+	(void)draw_count;
+	glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands,
+		max_draws, sizeof(DrawCommand));
+}
+
+void GpuDrivenRenderer::buildDepthPyramid(GLuint depth_texture, const glm::mat4 & view_projection)
+{
+	if (depth_pyramid_ == 0)
+		return;
+
+	glUseProgram(pyramid_program_);
+	glUniform1i(pyramid_depth_sampler_, 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+
+	//level zero is a copy of the depth buffer, every level after that keeps
+	//the furthest depth of the texels it covers in the level above
+	for (int level = 0; level < pyramid_levels_; level++)
+	{
+		const int width = std::max(1, pyramid_width_ >> level);
+		const int height = std::max(1, pyramid_height_ >> level);
+
+		glUniform1i(pyramid_copy_depth_, level == 0);
+		glBindImageTexture(0, depth_pyramid_, std::max(0, level - 1), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, depth_pyramid_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((width + kPyramidGroupSize - 1) / kPyramidGroupSize,
+			(height + kPyramidGroupSize - 1) / kPyramidGroupSize, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	pyramid_valid_ = true;
+	pyramid_view_projection_ = view_projection;
+}
+
+bool GpuDrivenRenderer::isOcclusionUpToDate(const glm::mat4 & view_projection) const
+{
+	return pyramid_valid_ && pyramid_view_projection_ == view_projection;
+}
+
+void GpuDrivenRenderer::readVisibleCounts(std::vector<unsigned int> & counts)
+{
+	counts.resize(material_count_ + 1);
+	glBindBuffer(GL_COPY_READ_BUFFER, count_buffer_);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, counts.size() * sizeof(unsigned int), counts.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+}
+
+bool GpuDrivenRenderer::pollMaterialDemand()
+{
+	//the buffer not being written this frame was written last frame, only
+	//read it if the GPU is done with it so the CPU never waits
+	const int read_index = (frame_index_ & 1) ^ 1;
+	GLsync& fence = demand_fences_[read_index];
+	if (fence == nullptr)
+		return false;
+
+	const GLenum status = glClientWaitSync(fence, 0, 0);
+	if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+		return false;
+	glDeleteSync(fence);
+	fence = nullptr;
+
+	glBindBuffer(GL_COPY_READ_BUFFER, demand_buffers_[read_index]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, demand_bits_.size() * sizeof(std::uint32_t), demand_bits_.data());
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	bool changed = false;
+	for (size_t i = 0; i < demand_bits_.size(); i++)
+	{
+		float demand = std::numeric_limits<float>::infinity();
+		//the shader stores the float bits so atomicMin can be used on them
+		if (demand_bits_[i] != kNoDemand)
+			std::memcpy(&demand, &demand_bits_[i], sizeof(float));
+		changed = changed || demand != material_demand_[i];
+		material_demand_[i] = demand;
+	}
+	return changed;
+}
+
+GLuint GpuDrivenRenderer::createComputeProgram(const std::string & path)
+{
+	GLint status = GL_FALSE;
+
+	GLuint shader = glCreateShader(GL_COMPUTE_SHADER);
+	std::string shader_string = tygra::createStringFromFile(path);
+	const char * shader_code = shader_string.c_str();
+	glShaderSource(shader, 1, (const GLchar **)&shader_code, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		const int string_length = 1024;
+		GLchar log[string_length] = "";
+		glGetShaderInfoLog(shader, string_length, NULL, log);
+		std::cerr << path << ": " << log << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+
+	GLuint program = glCreateProgram();
+	glAttachShader(program, shader);
+	glDeleteShader(shader);
+	glLinkProgram(program);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		const int string_length = 1024;
+		GLchar log[string_length] = "";
+		glGetProgramInfoLog(program, string_length, NULL, log);
+		std::cerr << path << ": " << log << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <tgl/tgl.h>
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Culls instances and builds their draw commands on the GPU.
+// Instance transforms, bounds and materials live in shader storage buffers,
+// a compute pass tests every instance against the frustum and the previous
+// frame's depth pyramid and appends a DrawElementsIndirectCommand for the
+// survivors into the command range of its material. Drawing is then one
+// multi draw per material, so CPU cost doesn't grow with the instance count.
+// All meshes share one vertex and element buffer so a single vertex array
+// serves every command.
+class GpuDrivenRenderer
+{
+public:
+
+	struct MeshInfo
+	{
+		glm::vec3 bounds_centre;
+		float bounds_radius;
+		float uv_density;
+	};
+
+	struct Instance
+	{
+		int mesh_index;
+		int material_index;
+		glm::mat4x3 xform;
+		// Where the instance's vertices start in the baked lighting
+		std::uint32_t baked_offset;
+	};
+
+	struct CullParameters
+	{
+		glm::mat4 view_projection;
+		glm::vec4 frustum_planes[6];
+		glm::vec3 camera_position;
+		float near_plane;
+		float pixels_per_unit;
+	};
+
+	// Needs GL 4.3 for compute shaders, storage buffers and indirect draws
+	static bool isSupported();
+
+	GpuDrivenRenderer();
+
+	~GpuDrivenRenderer();
+
+	bool start(int material_count);
+
+	void stop();
+
+	int addMesh(const void * vertices, int vertex_count, int vertex_size,
+		const unsigned int * elements, int element_count, const MeshInfo & info);
+
+	// Uploads the meshes added so far. Returns with the vertex array and the
+	// vertex buffer bound so the caller can describe its vertex layout,
+	// instance_attribute is used for the per draw instance index.
+	GLuint finishGeometry(GLuint instance_attribute);
+
+	void setInstances(const std::vector<Instance> & instances);
+
+	void resize(int width, int height);
+
+	void cull(const CullParameters & parameters, bool occlusion);
+
+	void bindGeometry();
+
+	void drawMaterial(int material_index);
+
+	// Builds the depth pyramid used to occlusion cull the next frame
+	void buildDepthPyramid(GLuint depth_texture, const glm::mat4 & view_projection);
+
+	// False until a pyramid has been built from the given view, culling
+	// against an older view can miss instances that just came into sight
+	bool isOcclusionUpToDate(const glm::mat4 & view_projection) const;
+
+	// Smallest texels per pixel, per texel of texture size, of the visible
+	// instances of each material as of a frame or two ago. Materials with no
+	// visible instance have a value of infinity.
+	const std::vector<float> & materialDemand() const { return material_demand_; }
+
+	// Picks up the demand of the last cull if the GPU has finished it, never
+	// waits. cull() does this itself, frames that don't cull call it so a
+	// late demand isn't lost. Returns true when materialDemand() changed.
+	bool pollMaterialDemand();
+
+	// Reads back how many instances of each material survived the last cull,
+	// this stalls so it is only meant for validation
+	void readVisibleCounts(std::vector<unsigned int> & counts);
+
+	bool hasIndirectCount() const { return has_indirect_count_; }
+
+private:
+
+	// These mirror the std430 structs in the compute shader
+	struct GpuInstance
+	{
+		glm::mat4 model;
+		glm::vec4 bounds;
+		std::uint32_t mesh_index;
+		std::uint32_t material_index;
+		std::uint32_t command_offset;
+		float uv_density;
+		std::uint32_t baked_offset;
+		std::uint32_t pad[3];
+	};
+	static_assert(sizeof(GpuInstance) == 112, "GpuInstance must match InstanceData in cull_cs.glsl");
+	static_assert(offsetof(GpuInstance, bounds) == 64 && offsetof(GpuInstance, mesh_index) == 80
+		&& offsetof(GpuInstance, baked_offset) == 96, "GpuInstance must match InstanceData in cull_cs.glsl");
+
+	struct GpuMesh
+	{
+		std::uint32_t first_index;
+		std::uint32_t index_count;
+		std::int32_t base_vertex;
+		std::uint32_t pad;
+	};
+	static_assert(sizeof(GpuMesh) == 16, "GpuMesh must match MeshData in cull_cs.glsl");
+
+	struct DrawCommand
+	{
+		std::uint32_t count;
+		std::uint32_t instance_count;
+		std::uint32_t first_index;
+		std::int32_t base_vertex;
+		std::uint32_t base_instance;
+	};
+	static_assert(sizeof(DrawCommand) == 20, "DrawCommand must match DrawElementsIndirectCommand");
+
+	GLuint createComputeProgram(const std::string & path);
+
+private:
+
+	GLuint cull_program_{ 0 };
+	GLuint pyramid_program_{ 0 };
+
+	// Uniform locations of the two compute programs
+	GLint cull_instance_count_{ -1 };
+	GLint cull_material_count_{ -1 };
+	GLint cull_frustum_planes_{ -1 };
+	GLint cull_camera_position_{ -1 };
+	GLint cull_near_plane_{ -1 };
+	GLint cull_pixels_per_unit_{ -1 };
+	GLint cull_occlusion_enabled_{ -1 };
+	GLint cull_pyramid_view_projection_{ -1 };
+	GLint cull_depth_pyramid_{ -1 };
+	GLint cull_pyramid_levels_{ -1 };
+	GLint pyramid_copy_depth_{ -1 };
+	GLint pyramid_depth_sampler_{ -1 };
+
+	GLuint vao_{ 0 };
+	GLuint vertex_vbo_{ 0 };
+	GLuint element_vbo_{ 0 };
+	GLuint instance_id_vbo_{ 0 };
+
+	GLuint instance_ssbo_{ 0 };
+	GLuint mesh_ssbo_{ 0 };
+	GLuint command_buffer_{ 0 };
+	GLuint count_buffer_{ 0 };
+	GLuint demand_buffers_[2]{ 0, 0 };
+	GLsync demand_fences_[2]{ nullptr, nullptr };
+	int frame_index_{ 0 };
+
+	GLuint depth_pyramid_{ 0 };
+	int pyramid_width_{ 0 };
+	int pyramid_height_{ 0 };
+	int pyramid_levels_{ 0 };
+	bool pyramid_valid_{ false };
+	glm::mat4 pyramid_view_projection_;
+
+	bool has_indirect_count_{ false };
+
+	std::vector<unsigned char> vertex_data_;
+	std::vector<unsigned int> element_data_;
+	std::vector<GpuMesh> meshes_;
+	std::vector<MeshInfo> mesh_infos_;
+
+	int material_count_{ 0 };
+	int instance_count_{ 0 };
+	// Instances the command and instance id buffers have room for
+	size_t instance_capacity_{ 0 };
+	std::vector<GpuInstance> gpu_instances_;
+	std::vector<std::uint32_t> material_offsets_;
+	std::vector<std::uint32_t> material_sizes_;
+	std::vector<std::uint32_t> demand_bits_;
+	std::vector<float> material_demand_;
+};
@@ -0,0 +1,403 @@
+#include "LightBaker.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+// Vertices are handed to the workers in chunks of this many
+static const size_t kVerticesPerChunk = 256;
+
+// Leaves are split until they hold no more than this many triangles
+static const size_t kTrianglesPerLeaf = 8;
+
+// Size of the traversal stack. Going down a level leaves at most one
+// sibling behind, so leaves are never built deeper than this minus one
+static const int kMaxTraversalDepth = 64;
+
+static const std::uint32_t kCacheMagic = 0x4b425053; // "SPBK"
+static const std::uint32_t kCacheVersion = 1;
+
+// FNV-1a, only used to tell whether the cache matches the scene
+static void hashBytes(std::uint64_t & hash, const void * data, size_t size)
+{
+	const unsigned char * bytes = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= bytes[i];
+		hash *= 0x100000001b3ull;
+	}
+}
+
+template<typename T>
+static void hashValue(std::uint64_t & hash, const T & value)
+{
+	hashBytes(hash, &value, sizeof(T));
+}
+
+LightBaker::LightBaker()
+{
+}
+
+LightBaker::~LightBaker()
+{
+	stop();
+}
+
+int LightBaker::addMesh(const std::vector<glm::vec3> & positions,
+	const std::vector<glm::vec3> & normals,
+	const std::vector<unsigned int> & elements)
+{
+	Mesh mesh;
+	mesh.positions = positions;
+	mesh.normals = normals;
+	mesh.elements = elements;
+	meshes_.push_back(std::move(mesh));
+	return (int)meshes_.size() - 1;
+}
+
+void LightBaker::start(const std::vector<Instance> & instances,
+	const std::vector<LightState> & lights, const std::string & cache_path)
+{
+	stop();
+
+	instances_ = instances;
+	lights_ = lights;
+	cache_path_ = cache_path;
+	finished_ = false;
+	cancelled_ = false;
+
+	thread_ = std::thread(&LightBaker::run, this);
+}
+
+void LightBaker::stop()
+{
+	cancelled_ = true;
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void LightBaker::run()
+{
+	const auto start_time = std::chrono::steady_clock::now();
+
+	std::uint32_t vertex_count = 0;
+	instance_offsets_.resize(instances_.size());
+	for (size_t i = 0; i < instances_.size(); i++)
+	{
+		instance_offsets_[i] = vertex_count;
+		if (instances_[i].mesh_index >= 0)
+			vertex_count += (std::uint32_t)meshes_[instances_[i].mesh_index].positions.size();
+	}
+
+	const std::uint64_t key = cacheKey();
+	if (loadCache(key, vertex_count))
+	{
+		std::cout << "Loaded baked lighting for " << vertex_count
+			<< " vertices from " << cache_path_ << std::endl;
+		finished_ = true;
+		return;
+	}
+
+	irradiance_.assign(vertex_count, glm::vec4(0, 0, 0, 0));
+	buildBvh();
+
+	next_vertex_ = 0;
+	const unsigned int hardware_threads = std::thread::hardware_concurrency();
+	const unsigned int worker_count = std::max(1u, hardware_threads > 1 ? hardware_threads - 1 : 1);
+	std::vector<std::thread> workers;
+	for (unsigned int i = 0; i < worker_count; i++)
+		workers.push_back(std::thread(&LightBaker::bakeWorker, this));
+	for (auto& worker : workers)
+		worker.join();
+
+	if (cancelled_)
+		return;
+
+	//the BVH is only needed while baking
+	std::vector<BvhNode>().swap(nodes_);
+	std::vector<TrianglePacket>().swap(packets_);
+
+	saveCache(key);
+
+	const float seconds = std::chrono::duration<float>(
+		std::chrono::steady_clock::now() - start_time).count();
+	std::cout << "Baked " << lights_.size() << " lights into " << vertex_count
+		<< " vertices on " << worker_count << " threads in " << seconds << "s" << std::endl;
+	finished_ = true;
+}
+
+void LightBaker::bakeWorker()
+{
+	const size_t vertex_count = irradiance_.size();
+	while (!cancelled_)
+	{
+		const size_t begin = next_vertex_.fetch_add(kVerticesPerChunk);
+		if (begin >= vertex_count)
+			return;
+		const size_t end = std::min(vertex_count, begin + kVerticesPerChunk);
+
+		//find the instance the chunk starts in, chunks can span instances
+		size_t instance_index = std::upper_bound(instance_offsets_.begin(),
+			instance_offsets_.end(), (std::uint32_t)begin) - instance_offsets_.begin() - 1;
+		for (size_t i = begin; i < end; i++)
+		{
+			while (instance_index + 1 < instances_.size() && instance_offsets_[instance_index + 1] <= i)
+				instance_index++;
+			const Instance& instance = instances_[instance_index];
+			const Mesh& mesh = meshes_[instance.mesh_index];
+			bakeVertex(instance, mesh, (int)(i - instance_offsets_[instance_index]), irradiance_[i]);
+		}
+	}
+}
+
+void LightBaker::bakeVertex(const Instance & instance, const Mesh & mesh, int vertex, glm::vec4 & irradiance) const
+{
+	//same maths as PointLight in sponza_fs.glsl minus the surface colour,
+	//which is applied when the baked value is used
+	const glm::vec3 position = instance.xform * glm::vec4(mesh.positions[vertex], 1.f);
+	const glm::vec3 normal = glm::mat3(instance.xform) * mesh.normals[vertex];
+	const float normal_length = glm::length(normal);
+	if (normal_length <= 0.f)
+		return;
+	const glm::vec3 N = normal / normal_length;
+
+	glm::vec3 total(0, 0, 0);
+	for (const auto& light : lights_)
+	{
+		const glm::vec3 to_light = light.position - position;
+		const float light_distance = glm::length(to_light);
+		if (light_distance <= 0.f || light_distance >= light.range)
+			continue;
+		const glm::vec3 L = to_light / light_distance;
+
+		const float diffuse_intensity = glm::dot(L, N);
+		if (diffuse_intensity <= 0.f)
+			continue;
+		const float attenuation = glm::smoothstep(light.range, light.range / 2, light_distance);
+		if (attenuation <= 0.f)
+			continue;
+
+		//start the shadow ray off the surface so it doesn't hit its own triangles
+		if (isOccluded(position + N * ray_offset_, L, light_distance - 2.f * ray_offset_))
+			continue;
+
+		total += light.intensity * diffuse_intensity * attenuation;
+	}
+	irradiance = glm::vec4(total, 0.f);
+}
+
+void LightBaker::buildBvh()
+{
+	std::vector<BuildTriangle> triangles;
+	glm::vec3 scene_min(FLT_MAX);
+	glm::vec3 scene_max(-FLT_MAX);
+	for (const auto& instance : instances_)
+	{
+		if (instance.mesh_index < 0)
+			continue;
+		const Mesh& mesh = meshes_[instance.mesh_index];
+		for (size_t i = 0; i + 2 < mesh.elements.size(); i += 3)
+		{
+			BuildTriangle triangle;
+			for (int j = 0; j < 3; j++)
+			{
+				triangle.vertices[j] = instance.xform * glm::vec4(mesh.positions[mesh.elements[i + j]], 1.f);
+				scene_min = glm::min(scene_min, triangle.vertices[j]);
+				scene_max = glm::max(scene_max, triangle.vertices[j]);
+			}
+			triangle.centroid = (triangle.vertices[0] + triangle.vertices[1] + triangle.vertices[2]) / 3.f;
+			triangles.push_back(triangle);
+		}
+	}
+
+	ray_offset_ = triangles.empty() ? 0.f : glm::length(scene_max - scene_min) * 1e-4f;
+
+	nodes_.clear();
+	packets_.clear();
+	nodes_.reserve(triangles.size() / kTrianglesPerLeaf * 2 + 1);
+	packets_.reserve(triangles.size() / 4 + 1);
+	if (!triangles.empty())
+		buildNode(triangles, 0, triangles.size(), 0);
+}
+
+std::uint32_t LightBaker::buildNode(std::vector<BuildTriangle> & triangles, size_t begin, size_t end, int depth)
+{
+	const std::uint32_t index = (std::uint32_t)nodes_.size();
+	nodes_.push_back(BvhNode());
+
+	glm::vec3 bounds_min(FLT_MAX);
+	glm::vec3 bounds_max(-FLT_MAX);
+	glm::vec3 centroid_min(FLT_MAX);
+	glm::vec3 centroid_max(-FLT_MAX);
+	for (size_t i = begin; i < end; i++)
+	{
+		for (const auto& vertex : triangles[i].vertices)
+		{
+			bounds_min = glm::min(bounds_min, vertex);
+			bounds_max = glm::max(bounds_max, vertex);
+		}
+		centroid_min = glm::min(centroid_min, triangles[i].centroid);
+		centroid_max = glm::max(centroid_max, triangles[i].centroid);
+	}
+	nodes_[index].bounds_min = bounds_min;
+	nodes_[index].bounds_max = bounds_max;
+
+	const glm::vec3 extent = centroid_max - centroid_min;
+	const int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+
+	//the median split halves the triangles so the depth limit is only there
+	//to keep the traversal stack from overflowing
+	if (end - begin <= kTrianglesPerLeaf || extent[axis] <= 0.f || depth + 1 >= kMaxTraversalDepth)
+	{
+		nodes_[index].first = (std::uint32_t)packets_.size();
+		nodes_[index].count = 0;
+		for (size_t i = begin; i < end; i += 4)
+		{
+			TrianglePacket packet;
+			std::memset(&packet, 0, sizeof(packet));
+			for (size_t lane = 0; lane < 4 && i + lane < end; lane++)
+			{
+				const BuildTriangle& triangle = triangles[i + lane];
+				const glm::vec3 edge1 = triangle.vertices[1] - triangle.vertices[0];
+				const glm::vec3 edge2 = triangle.vertices[2] - triangle.vertices[0];
+				for (int c = 0; c < 3; c++)
+				{
+					packet.v0[c][lane] = triangle.vertices[0][c];
+					packet.edge1[c][lane] = edge1[c];
+					packet.edge2[c][lane] = edge2[c];
+				}
+			}
+			packets_.push_back(packet);
+			nodes_[index].count++;
+		}
+		return index;
+	}
+
+	//split at the median centroid of the longest axis
+	const size_t middle = begin + (end - begin) / 2;
+	std::nth_element(triangles.begin() + begin, triangles.begin() + middle, triangles.begin() + end,
+		[axis](const BuildTriangle& a, const BuildTriangle& b) { return a.centroid[axis] < b.centroid[axis]; });
+
+	buildNode(triangles, begin, middle, depth + 1);
+	const std::uint32_t right = buildNode(triangles, middle, end, depth + 1);
+	nodes_[index].first = right;
+	nodes_[index].count = 0;
+	return index;
+}
+
+bool LightBaker::isOccluded(const glm::vec3 & origin, const glm::vec3 & direction, float max_distance) const
+{
+	if (nodes_.empty() || max_distance <= 0.f)
+		return false;
+
+	const glm::vec3 inverse_direction = 1.f / direction;
+
+	std::uint32_t stack[kMaxTraversalDepth];
+	int stack_size = 0;
+	stack[stack_size++] = 0;
+	while (stack_size > 0)
+	{
+		const std::uint32_t index = stack[--stack_size];
+		const BvhNode& node = nodes_[index];
+
+		//slab test against the node bounds
+		const glm::vec3 t0 = (node.bounds_min - origin) * inverse_direction;
+		const glm::vec3 t1 = (node.bounds_max - origin) * inverse_direction;
+		const glm::vec3 t_near = glm::min(t0, t1);
+		const glm::vec3 t_far = glm::max(t0, t1);
+		const float enter = glm::max(glm::max(t_near.x, t_near.y), glm::max(t_near.z, 0.f));
+		const float exit = glm::min(glm::min(t_far.x, t_far.y), glm::min(t_far.z, max_distance));
+		if (enter > exit)
+			continue;
+
+		if (node.count > 0)
+		{
+			for (std::uint32_t i = 0; i < node.count; i++)
+			{
+				if (intersectPacket(packets_[node.first + i], origin, direction, max_distance))
+					return true;
+			}
+		}
+		else
+		{
+			//buildNode stops splitting before this can happen
+			assert(stack_size + 2 <= kMaxTraversalDepth);
+			stack[stack_size++] = node.first;
+			stack[stack_size++] = index + 1;
+		}
+	}
+	return false;
+}
+
+std::uint64_t LightBaker::cacheKey() const
+{
+	std::uint64_t hash = 0xcbf29ce484222325ull;
+	hashValue(hash, kCacheVersion);
+	for (const auto& light : lights_)
+	{
+		hashValue(hash, light.position);
+		hashValue(hash, light.intensity);
+		hashValue(hash, light.range);
+	}
+	for (const auto& instance : instances_)
+	{
+		hashValue(hash, instance.mesh_index);
+		hashValue(hash, instance.xform);
+	}
+	for (const auto& mesh : meshes_)
+	{
+		hashBytes(hash, mesh.positions.data(), mesh.positions.size() * sizeof(glm::vec3));
+		hashBytes(hash, mesh.normals.data(), mesh.normals.size() * sizeof(glm::vec3));
+		hashBytes(hash, mesh.elements.data(), mesh.elements.size() * sizeof(unsigned int));
+	}
+	return hash;
+}
+
+bool LightBaker::loadCache(std::uint64_t key, std::uint32_t expected_count)
+{
+	std::ifstream file(cache_path_, std::ios::binary);
+	if (!file)
+		return false;
+
+	std::uint32_t magic = 0, version = 0, vertex_count = 0;
+	std::uint64_t file_key = 0;
+	file.read((char *)&magic, sizeof(magic));
+	file.read((char *)&version, sizeof(version));
+	file.read((char *)&file_key, sizeof(file_key));
+	file.read((char *)&vertex_count, sizeof(vertex_count));
+	if (!file || magic != kCacheMagic || version != kCacheVersion || file_key != key)
+		return false;
+
+	//the offsets come from the instances which are part of the key, so only
+	//the vertex count needs to agree
+	if (vertex_count != expected_count)
+		return false;
+
+	irradiance_.resize(vertex_count);
+	file.read((char *)irradiance_.data(), vertex_count * sizeof(glm::vec4));
+	if (!file)
+	{
+		std::cerr << "Scene cache " << cache_path_ << " is truncated, baking again" << std::endl;
+		irradiance_.clear();
+		return false;
+	}
+	return true;
+}
+
+void LightBaker::saveCache(std::uint64_t key) const
+{
+	std::ofstream file(cache_path_, std::ios::binary | std::ios::trunc);
+	const std::uint32_t vertex_count = (std::uint32_t)irradiance_.size();
+	file.write((const char *)&kCacheMagic, sizeof(kCacheMagic));
+	file.write((const char *)&kCacheVersion, sizeof(kCacheVersion));
+	file.write((const char *)&key, sizeof(key));
+	file.write((const char *)&vertex_count, sizeof(vertex_count));
+	file.write((const char *)irradiance_.data(), vertex_count * sizeof(glm::vec4));
+	if (!file)
+		std::cerr << "Failed to write the scene cache " << cache_path_ << std::endl;
+}
@@ -0,0 +1,115 @@
+#pragma once
+
+#include "SceneSnapshot.hpp"
+#include "TrianglePacket.hpp"
+
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Bakes the diffuse light of the static point lights into every vertex of
+// every instance, shadows included.
+// The scene is turned into a BVH over world space triangles and worker
+// threads trace a shadow ray from each vertex to each light, testing four
+// triangles at a time with SSE. The result is written to a scene cache file
+// so later runs with the same geometry and lights only need to read it.
+// Everything runs on a background thread, poll isFinished() from the GL
+// thread and only read the results once it returns true.
+class LightBaker
+{
+public:
+
+	struct Instance
+	{
+		int mesh_index; // -1 for instances without a mesh, they get no vertices
+		glm::mat4x3 xform;
+	};
+
+	LightBaker();
+
+	~LightBaker();
+
+	// The mesh data is copied so baking doesn't depend on the caller's buffers
+	int addMesh(const std::vector<glm::vec3> & positions,
+		const std::vector<glm::vec3> & normals,
+		const std::vector<unsigned int> & elements);
+
+	void start(const std::vector<Instance> & instances,
+		const std::vector<LightState> & lights, const std::string & cache_path);
+
+	void stop();
+
+	bool isFinished() const { return finished_; }
+
+	// Irradiance of every instance vertex in rgb
+	const std::vector<glm::vec4> & irradiance() const { return irradiance_; }
+
+	// Where the vertices of each instance start in irradiance()
+	const std::vector<std::uint32_t> & instanceOffsets() const { return instance_offsets_; }
+
+private:
+
+	struct Mesh
+	{
+		std::vector<glm::vec3> positions;
+		std::vector<glm::vec3> normals;
+		std::vector<unsigned int> elements;
+	};
+
+	// Interior nodes have a count of zero, their left child follows them and
+	// first is the right child. Leaves hold count packets starting at first.
+	struct BvhNode
+	{
+		glm::vec3 bounds_min;
+		std::uint32_t first;
+		glm::vec3 bounds_max;
+		std::uint32_t count;
+	};
+
+	struct BuildTriangle
+	{
+		glm::vec3 vertices[3];
+		glm::vec3 centroid;
+	};
+
+	void run();
+
+	void bakeWorker();
+
+	void bakeVertex(const Instance & instance, const Mesh & mesh, int vertex, glm::vec4 & irradiance) const;
+
+	void buildBvh();
+
+	std::uint32_t buildNode(std::vector<BuildTriangle> & triangles, size_t begin, size_t end, int depth);
+
+	bool isOccluded(const glm::vec3 & origin, const glm::vec3 & direction, float max_distance) const;
+
+	std::uint64_t cacheKey() const;
+
+	bool loadCache(std::uint64_t key, std::uint32_t expected_count);
+
+	void saveCache(std::uint64_t key) const;
+
+private:
+
+	std::vector<Mesh> meshes_;
+	std::vector<Instance> instances_;
+	std::vector<LightState> lights_;
+	std::string cache_path_;
+
+	std::vector<BvhNode> nodes_;
+	std::vector<TrianglePacket> packets_;
+	float ray_offset_{ 0.f };
+
+	std::vector<glm::vec4> irradiance_;
+	std::vector<std::uint32_t> instance_offsets_;
+
+	std::thread thread_;
+	std::atomic<bool> finished_{ false };
+	std::atomic<bool> cancelled_{ false };
+	std::atomic<size_t> next_vertex_{ 0 };
+};
@@ -1,5 +1,6 @@
 #include "MyController.hpp"
 #include "MyView.hpp"
+#include "Simulation.hpp"
 
 #include <sponza/sponza.hpp>
 #include <tygra/Window.hpp>
@@ -10,18 +11,33 @@
 MyController::MyController()
 {
     scene_ = new sponza::Context();
+    simulation_ = new Simulation(scene_);
     view_ = new MyView();
     view_->setScene(scene_);
+    view_->setSimulation(simulation_);
 }
 
 MyController::~MyController()
 {
     delete view_;
+    delete simulation_;
     delete scene_;
 }
 
+void MyController::waitForNextFrame()
+{
+    // When the view had nothing new to draw there is no point spinning,
+    // sleep until the simulation publishes a change. The timeout keeps the
+    // window polling for input while the scene is still.
+    if (view_->lastFrameWasSkipped()) {
+        simulation_->waitForChange(view_->renderedRevision(),
+                                   Simulation::tickDuration());
+    }
+}
+
 void MyController::windowControlWillStart(tygra::Window * window)
 {
+    simulation_->start();
     window->setView(view_);
     window->setTitle("3D Graphics Programming :: SpiceMySponza");
 }
@@ -29,14 +45,12 @@ void MyController::windowControlWillStart(tygra::Window * window)
 void MyController::windowControlDidStop(tygra::Window * window)
 {
     window->setView(nullptr);
+    simulation_->stop();
 }
 
 void MyController::windowControlViewWillRender(tygra::Window * window)
 {
-    scene_->update();
-    if (camera_turn_mode_) {
-        scene_->getCamera().setRotationalVelocity(sponza::Vector2(0, 0));
-    }
+    // the scene is advanced by the simulation thread at a fixed tick
 }
 
 void MyController::windowControlMouseMoved(tygra::Window * window,
@@ -49,8 +63,8 @@ void MyController::windowControlMouseMoved(tygra::Window * window,
         int dx = x - prev_x;
         int dy = y - prev_y;
         const float mouse_speed = 0.6f;
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(-dx * mouse_speed, -dy * mouse_speed));
+        simulation_->pushInput(Simulation::InputEvent::kRotationalImpulse,
+            glm::vec3(-dx * mouse_speed, -dy * mouse_speed, 0));
     }
     prev_x = x;
     prev_y = y;
@@ -99,10 +113,26 @@ void MyController::windowControlKeyboardChanged(tygra::Window * window,
     if (!down)
         return;
 
-    //switch (key_index)
-    //{
-    //    // TODO: put usual keypress responses here
-    //}
+    switch (key_index)
+    {
+    case 'L':
+        animate_lights_ = !animate_lights_;
+        simulation_->pushInput(Simulation::InputEvent::kLightAnimation,
+            glm::vec3(animate_lights_ ? 1.f : 0.f, 0, 0));
+        break;
+    case 'G':
+        view_->setGpuDriven(!view_->isGpuDriven());
+        break;
+    case 'H':
+        view_->setOcclusionCulling(!view_->isOcclusionCulling());
+        break;
+    case 'V':
+        view_->setGpuValidation(!view_->isGpuValidation());
+        break;
+    case 'B':
+        view_->setBakedLighting(!view_->isBakedLighting());
+        break;
+    }
 }
 
 void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
@@ -148,9 +178,9 @@ void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
         else {
             camera_rotate_speed_[0] = 0.f;
         }
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
-                camera_rotate_speed_[1] * rotate_speed));
+        simulation_->pushInput(Simulation::InputEvent::kRotationalVelocity,
+            glm::vec3(camera_rotate_speed_[0] * rotate_speed,
+                camera_rotate_speed_[1] * rotate_speed, 0));
         break;
     case tygra::kWindowGamepadAxisRightThumbY:
         if (pos < -deadzone || pos > deadzone) {
@@ -159,9 +189,9 @@ void MyController::windowControlGamepadAxisMoved(tygra::Window * window,
         else {
             camera_rotate_speed_[1] = 0.f;
         }
-        scene_->getCamera().setRotationalVelocity(
-            sponza::Vector2(camera_rotate_speed_[0] * rotate_speed,
-                camera_rotate_speed_[1] * rotate_speed));
+        simulation_->pushInput(Simulation::InputEvent::kRotationalVelocity,
+            glm::vec3(camera_rotate_speed_[0] * rotate_speed,
+                camera_rotate_speed_[1] * rotate_speed, 0));
         break;
     }
 
@@ -182,6 +212,6 @@ void MyController::updateCameraTranslation()
         + key_speed * camera_move_speed_[1];
     const float forward_speed = key_speed * camera_move_speed_[2]
         - key_speed * camera_move_speed_[3];
-    scene_->getCamera().setLinearVelocity(
-        sponza::Vector3(sideward_speed, 0, forward_speed));
+    simulation_->pushInput(Simulation::InputEvent::kLinearVelocity,
+        glm::vec3(sideward_speed, 0, forward_speed));
 }
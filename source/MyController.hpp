@@ -3,6 +3,7 @@
 #include <sponza/sponza_fwd.hpp>
 
 class MyView;
+class Simulation;
 
 class MyController : public tygra::WindowControlDelegate
 {
@@ -12,6 +13,10 @@ public:
 
     ~MyController();
 
+    // Called by the main loop after each window update, blocks while the
+    // scene is still so an idle window doesn't burn CPU and GPU time
+    void waitForNextFrame();
+
 private:
 
     void windowControlWillStart(tygra::Window * window) override;
@@ -50,9 +55,11 @@ private:
 private:
 
     MyView * view_{ nullptr };
+    Simulation * simulation_{ nullptr };
     sponza::Context * scene_{ nullptr };
 
     bool camera_turn_mode_{ false };
+    bool animate_lights_{ true };
     float camera_move_speed_[4]{ 0.f, 0.f, 0.f, 0.f };
     float camera_rotate_speed_[2]{ 0.f, 0.f };
 };
@@ -1,11 +1,20 @@
 #include "MyView.hpp"
+#include "AllocationTracker.hpp"
+#include "Frustum.hpp"
+#include "Simulation.hpp"
 #include <sponza/sponza.hpp>
 #include <tygra/FileHelper.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <string>
 //#include <cassert>
 
+// Where the baked lighting is kept between runs
+static const char * kSceneCachePath = "sponza_scene.cache";
+
 MyView::MyView()
 {
 }
@@ -15,46 +24,34 @@ MyView::~MyView() {
 
 void MyView::setScene(const sponza::Context * scene)
 {
-    scene_ = scene;
+    // The simulation thread updates the scene once it starts, so everything
+    // the render thread needs from it that never changes is copied here
+    m_materials.clear();
+    for (const auto& material : scene->getAllMaterials()) {
+        MaterialState state;
+        state.id = material.getId();
+        state.ambient_colour = (const glm::vec3&)material.getAmbientColour();
+        state.diffuse_colour = (const glm::vec3&)material.getDiffuseColour();
+        state.specular_colour = (const glm::vec3&)material.getSpecularColour();
+        state.shininess = material.getShininess();
+        state.diffuse_texture = material.getDiffuseTexture();
+        state.specular_texture = material.getSpecularTexture();
+        m_materials.push_back(state);
+    }
 }
 
-void MyView::windowViewWillStart(tygra::Window * window)
+void MyView::setSimulation(Simulation * simulation)
 {
-    assert(scene_ != nullptr);
+    simulation_ = simulation;
+}
 
-	GLint compile_status = GL_FALSE;
+void MyView::windowViewWillStart(tygra::Window * window)
+{
+    assert(!m_materials.empty());
+    assert(simulation_ != nullptr);
 
-	GLuint vertex_shader = glCreateShader(GL_VERTEX_SHADER);
-	std::string vertex_shader_string
-		= tygra::createStringFromFile("resource:///sponza_vs.glsl");
-	const char * vertex_shader_code = vertex_shader_string.c_str();
-	glShaderSource(vertex_shader, 1,
-		(const GLchar **)&vertex_shader_code, NULL);
-	glCompileShader(vertex_shader);
-	glGetShaderiv(vertex_shader, GL_COMPILE_STATUS, &compile_status);
-	if (compile_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetShaderInfoLog(vertex_shader, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
-
-	GLuint fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
-	std::string fragment_shader_string
-		= tygra::createStringFromFile("resource:///sponza_fs.glsl");
-	const char * fragment_shader_code = fragment_shader_string.c_str();
-	glShaderSource(fragment_shader, 1,
-		(const GLchar **)&fragment_shader_code, NULL);
-	glCompileShader(fragment_shader);
-	glGetShaderiv(fragment_shader, GL_COMPILE_STATUS, &compile_status);
-	if (compile_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetShaderInfoLog(fragment_shader, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
+	GLuint vertex_shader = compileShader(GL_VERTEX_SHADER, "resource:///sponza_vs.glsl");
+	GLuint fragment_shader = compileShader(GL_FRAGMENT_SHADER, "resource:///sponza_fs.glsl");
 
 	// Create shader program & shader in variables
 	shader_program_ = glCreateProgram();
@@ -68,17 +65,35 @@ void MyView::windowViewWillStart(tygra::Window * window)
 	glDeleteShader(vertex_shader);
 	glAttachShader(shader_program_, fragment_shader);
 	glDeleteShader(fragment_shader);
-	glLinkProgram(shader_program_);
+	linkProgram(shader_program_);
+	lookupUniforms(shader_program_, uniforms_);
+
+	//program used to put the last rendered frame on screen
+	present_program_ = glCreateProgram();
+	vertex_shader = compileShader(GL_VERTEX_SHADER, "resource:///present_vs.glsl");
+	fragment_shader = compileShader(GL_FRAGMENT_SHADER, "resource:///present_fs.glsl");
+	glAttachShader(present_program_, vertex_shader);
+	glAttachShader(present_program_, fragment_shader);
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+	linkProgram(present_program_);
+	present_frame_sampler_ = glGetUniformLocation(present_program_, "frame_sampler");
 
-	GLint link_status = GL_FALSE;
-	glGetProgramiv(shader_program_, GL_LINK_STATUS, &link_status);
-	if (link_status != GL_TRUE)
-	{
-		const int string_length = 1024;
-		GLchar log[string_length] = "";
-		glGetProgramInfoLog(shader_program_, string_length, NULL, log);
-		std::cerr << log << std::endl;
-	}
+	//the present triangle has no vertex data but core profile still needs a vao
+	glGenVertexArrays(1, &present_vao_);
+
+	//the frame is rendered off screen so it can be shown again when nothing
+	//changed, the storage is sized in windowViewDidReset
+	glGenFramebuffers(1, &frame_fbo_);
+	glGenRenderbuffers(1, &frame_colour_rbo_);
+	glGenRenderbuffers(1, &frame_depth_rbo_);
+	glGenFramebuffers(1, &resolve_fbo_);
+	glGenTextures(1, &resolve_texture_);
+	glGenTextures(1, &resolve_depth_texture_);
+
+	//the GPU driven path needs compute shaders, without them the CPU path is
+	//all there is
+	const bool gpu_driven_supported = GpuDrivenRenderer::isSupported();
 
 	/*
 		The framework provides a builder class that allows access to all the mesh data	
@@ -113,30 +128,99 @@ void MyView::windowViewWillStart(tygra::Window * window)
 		Mesh mesh;
 		//Build the mesh passing the elements and vertices
 		buildMesh(mesh, source.getId(), vertices, elements);
+		computeMeshBounds(mesh, vertices, elements);
+		m_meshIndexById[mesh.mesh_id] = m_meshVector.size();
 		m_meshVector.push_back(mesh);
+
+		std::vector<glm::vec3> bake_positions(vertices.size());
+		std::vector<glm::vec3> bake_normals(vertices.size());
+		for (size_t i = 0; i < vertices.size(); i++)
+		{
+			bake_positions[i] = vertices[i].position;
+			bake_normals[i] = vertices[i].normal;
+		}
+		light_baker_.addMesh(bake_positions, bake_normals, elements);
+
+		if (gpu_driven_supported)
+		{
+			GpuDrivenRenderer::MeshInfo info;
+			info.bounds_centre = mesh.bounds_centre;
+			info.bounds_radius = mesh.bounds_radius;
+			info.uv_density = mesh.uv_density;
+			gpu_renderer_.addMesh(vertices.data(), (int)vertices.size(), sizeof(Vertex),
+				elements.data(), (int)elements.size(), info);
+		}
 	}
 
-	//create textures
-	auto& materials = scene_->getAllMaterials();
-	for(auto& mat : materials)
+	//create textures, only the small tail mips are loaded up front and the
+	//rest is streamed in once we know what is on screen
+	texture_streamer_.start();
+	for(auto& mat : m_materials)
 	{
 		//Diffuse texture
-		auto& diffusePath = mat.getDiffuseTexture();
+		auto& diffusePath = mat.diffuse_texture;
 		if (!diffusePath.empty() && m_textures.find(diffusePath) == m_textures.end())
 		{
-			GLuint texID = 0;
-			createTexture("resource:///" + diffusePath, texID);
-			m_textures[diffusePath] = texID;
+			m_textures[diffusePath] = texture_streamer_.addTexture("resource:///" + diffusePath);
 		}
 
 		//Specular Texture
-		auto& specularPath = mat.getSpecularTexture();
+		auto& specularPath = mat.specular_texture;
 		if (!specularPath.empty() && m_textures.find(specularPath) == m_textures.end())
 		{
-			GLuint texID = 0;
-			createTexture("resource:///" + specularPath, texID);
-			m_textures[specularPath] = texID;
+			m_textures[specularPath] = texture_streamer_.addTexture("resource:///" + specularPath);
 		}
+
+		//remember the handles per material so drawing never looks up paths
+		MaterialTextures& textures = m_materialTextures[mat.id];
+		if (!diffusePath.empty())
+			textures.diffuse = m_textures[diffusePath];
+		if (!specularPath.empty())
+			textures.specular = m_textures[specularPath];
+		textures.material = &mat;
+		textures.index = (int)m_materialIds.size();
+		m_materialIds.push_back(mat.id);
+	}
+	texture_streamer_.flush();
+
+	if (gpu_driven_supported && gpu_renderer_.start((int)m_materialIds.size()))
+	{
+		vertex_shader = compileShader(GL_VERTEX_SHADER, "resource:///sponza_gpu_vs.glsl");
+		fragment_shader = compileShader(GL_FRAGMENT_SHADER, "resource:///sponza_fs.glsl");
+		gpu_program_ = glCreateProgram();
+		glAttachShader(gpu_program_, vertex_shader);
+		glBindAttribLocation(gpu_program_, kVertexPosition, "vertex_position");
+		glBindAttribLocation(gpu_program_, kVertexNormal, "vertex_normal");
+		glBindAttribLocation(gpu_program_, kVertexUV, "vertex_uv");
+		glBindAttribLocation(gpu_program_, kVertexInstance, "instance_index");
+		glDeleteShader(vertex_shader);
+		glAttachShader(gpu_program_, fragment_shader);
+		glDeleteShader(fragment_shader);
+		linkProgram(gpu_program_);
+		lookupUniforms(gpu_program_, gpu_uniforms_);
+
+		//sized once so validating never allocates, one per material and the total
+		gpu_visible_counts_.assign(m_materialIds.size() + 1, 0);
+		cpu_visible_counts_.assign(m_materialIds.size() + 1, 0);
+		cpu_possible_counts_.assign(m_materialIds.size() + 1, 0);
+
+		//every mesh shares one vertex buffer so the layout is only set up once
+		gpu_renderer_.finishGeometry(kVertexInstance);
+		glEnableVertexAttribArray(kVertexPosition);
+		glVertexAttribPointer(kVertexPosition, 3, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex), (GLvoid*)offsetof(Vertex, Vertex::position));
+		glEnableVertexAttribArray(kVertexNormal);
+		glVertexAttribPointer(kVertexNormal, 3, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex), (GLvoid*)offsetof(Vertex, Vertex::normal));
+		glEnableVertexAttribArray(kVertexUV);
+		glVertexAttribPointer(kVertexUV, 2, GL_FLOAT, GL_FALSE,
+			sizeof(Vertex), (GLvoid*)offsetof(Vertex, Vertex::texCoord));
+		glBindBuffer(GL_ARRAY_BUFFER, kNullId);
+		glBindVertexArray(kNullId);
+	}
+	else if (gpu_driven_supported)
+	{
+		gpu_renderer_.stop();
 	}
 }
 
@@ -145,15 +229,141 @@ void MyView::windowViewDidReset(tygra::Window * window,
                                 int height)
 {
     glViewport(0, 0, width, height);
+
+	if (width > 0 && height > 0)
+		resizeFrameBuffers(width, height);
+
+	invalidate();
 }
 
 void MyView::windowViewDidStop(tygra::Window * window)
 {
+	std::cout << "Frames rendered: " << frames_rendered_
+		<< ", frames skipped: " << frames_skipped_ << std::endl;
+
+	const auto texture_stats = texture_streamer_.stats();
+	std::cout << "Texture bytes resident: " << texture_stats.resident_bytes
+		<< ", requested: " << texture_stats.requested_bytes
+		<< ", budget: " << texture_stats.budget_bytes << std::endl;
+	texture_streamer_.stop();
+	light_baker_.stop();
+	glDeleteTextures(1, &baked_irradiance_texture_);
+	glDeleteBuffers(1, &baked_irradiance_buffer_);
+
+	if (gpu_program_ != 0)
+	{
+		if (gpu_validation_failures_ > 0)
+			std::cout << "GPU cull validation failures: " << gpu_validation_failures_ << std::endl;
+		gpu_renderer_.stop();
+		glDeleteProgram(gpu_program_);
+		gpu_program_ = 0;
+	}
+
+	if (AllocationTracker::isEnabled())
+	{
+		std::cout << "Frames with render path allocations after warm up: "
+			<< steady_state_allocating_frames_ << std::endl;
+	}
+
+	glDeleteFramebuffers(1, &frame_fbo_);
+	glDeleteRenderbuffers(1, &frame_colour_rbo_);
+	glDeleteRenderbuffers(1, &frame_depth_rbo_);
+	glDeleteFramebuffers(1, &resolve_fbo_);
+	glDeleteTextures(1, &resolve_texture_);
+	glDeleteTextures(1, &resolve_depth_texture_);
+	glDeleteVertexArrays(1, &present_vao_);
+	glDeleteProgram(present_program_);
+}
+
+void MyView::invalidate()
+{
+	invalidated_ = true;
+}
+
+void MyView::setGpuDriven(bool enabled)
+{
+	if (enabled && gpu_program_ == 0)
+	{
+		std::cerr << "GPU driven rendering needs OpenGL 4.3" << std::endl;
+		return;
+	}
+	gpu_driven_ = enabled;
+	std::cout << "GPU driven rendering " << (enabled ? "on" : "off") << std::endl;
+	invalidate();
+}
+
+void MyView::setBakedLighting(bool enabled)
+{
+	baked_lighting_ = enabled;
+	std::cout << "Baked lighting " << (enabled ? "on" : "off") << std::endl;
+	invalidate();
+}
+
+void MyView::setOcclusionCulling(bool enabled)
+{
+	gpu_occlusion_ = enabled;
+	std::cout << "Occlusion culling " << (enabled ? "on" : "off") << std::endl;
+	invalidate();
+}
+
+void MyView::setGpuValidation(bool enabled)
+{
+	gpu_validation_ = enabled;
+	std::cout << "GPU cull validation " << (enabled ? "on" : "off") << std::endl;
+	invalidate();
 }
 
 void MyView::windowViewRender(tygra::Window * window)
 {
-	assert(scene_ != nullptr);
+	// The scene is owned by the simulation thread so everything that moves
+	// is read from the newest snapshot it published. The camera is blended
+	// between the last two ticks so motion is smooth at any frame rate.
+	auto& snapshots = simulation_->snapshots();
+	snapshots.acquire();
+	const SceneSnapshot& snapshot = snapshots.front();
+	const float alpha = Simulation::interpolationFactor(snapshot,
+		Simulation::Clock::now());
+
+	// Newly streamed mips change how the scene looks. Streaming allocates
+	// while it loads so it is kept out of the allocation count below.
+	if (texture_streamer_.update())
+		invalidate();
+	updateBakedLighting(snapshot);
+
+	// The GPU driven path hears which mips it needs a frame after culling,
+	// if that moved since the last frame drawn the view hasn't settled
+	if (gpu_driven_ && gpu_program_ != 0 && gpu_renderer_.pollMaterialDemand())
+		invalidate();
+
+	//the point lights are looked up from the bake when it matches the instances
+	const bool use_baked = baked_lighting_ && bake_ready_
+		&& snapshot.instances_revision == baked_instances_revision_;
+
+	// Uploading changed instances sizes buffers, so it goes before the count
+	if (gpu_driven_ && gpu_program_ != 0)
+		updateGpuInstances(snapshot, use_baked);
+
+	const std::uint64_t allocations_at_start = AllocationTracker::threadAllocationCount();
+	frame_arena_.reset();
+
+	// Nothing has changed since the last frame we drew and it wasn't drawn
+	// mid blend, so just put that frame back on screen
+	const bool invalidated = invalidated_.exchange(false);
+	if (!invalidated && snapshot.revision == rendered_revision_ && rendered_settled_)
+	{
+		presentFrame();
+		frames_skipped_++;
+		last_frame_skipped_ = true;
+		checkFrameAllocations(allocations_at_start);
+		return;
+	}
+	rendered_revision_ = snapshot.revision;
+	rendered_settled_ = alpha >= 1.f || !snapshot.isMoving();
+	frames_rendered_++;
+	last_frame_skipped_ = false;
+	texture_streamer_.beginFrame();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo_);
 
 	// Configure pipeline settings
 	glEnable(GL_DEPTH_TEST);
@@ -163,8 +373,6 @@ void MyView::windowViewRender(tygra::Window * window)
 	glClearColor(0.f, 0.f, 0.25f, 0.f);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	glUseProgram(shader_program_);
-	 
 	// Compute viewport
 	GLint viewport_size[4];
 	glGetIntegerv(GL_VIEWPORT, viewport_size);
@@ -172,173 +380,583 @@ void MyView::windowViewRender(tygra::Window * window)
 
 	// Note: the code above is supplied for you and already works
 
-	//Compute projection matrix
-	const auto& camera = scene_->getCamera();
-	glm::mat4 projection_xform = glm::perspective(glm::radians(camera.getVerticalFieldOfViewInDegrees()), aspect_ratio, camera.getNearPlaneDistance(), camera.getFarPlaneDistance());
+	const CameraState& camera = snapshot.camera;
+	const glm::vec3 camera_pos = glm::mix(snapshot.previous_camera.position,
+		camera.position, alpha);
+	const glm::vec3 camera_dir = glm::normalize(glm::mix(
+		snapshot.previous_camera.direction, camera.direction, alpha));
+	const float light_time_seconds = glm::mix(snapshot.previous_light_time_seconds,
+		snapshot.light_time_seconds, alpha);
 
-	//Compute view matrix
-	const auto& camera_pos = (const glm::vec3&)scene_->getCamera().getPosition();
+	//Compute projection matrix
+	glm::mat4 projection_xform = glm::perspective(glm::radians(camera.vertical_fov_degrees), aspect_ratio, camera.near_plane, camera.far_plane);
 
 	// Compute camera view matrix and combine with projection matrix
-	glm::vec3 lookAtPos = (camera_pos + glm::vec3(camera.getDirection().x, camera.getDirection().y, camera.getDirection().z) * 5.0f);
+	glm::vec3 lookAtPos = camera_pos + camera_dir * 5.0f;
 	glm::mat4 view_xform = glm::lookAt(camera_pos, lookAtPos, glm::vec3(0,1,0));
 
-	glm::mat4 view_projection = projection_xform * view_xform;
+	FrameView view;
+	view.view_projection = projection_xform * view_xform;
+	view.camera_position = camera_pos;
+	view.near_plane = camera.near_plane;
 
-	//Sent matrices to the GPU via a uniform.
-	auto ViewLocation = glGetUniformLocation(shader_program_, "view_xform");
-	glUniformMatrix4fv(ViewLocation, 1, GL_FALSE, glm::value_ptr(view_xform));
+	// Frustum planes for culling instances, pointing inwards
+	const glm::mat4 vp_rows = glm::transpose(view.view_projection);
+	for (int i = 0; i < 3; i++)
+	{
+		view.frustum_planes[i * 2 + 0] = vp_rows[3] + vp_rows[i];
+		view.frustum_planes[i * 2 + 1] = vp_rows[3] - vp_rows[i];
+	}
+	for (auto& plane : view.frustum_planes)
+		plane /= glm::length(glm::vec3(plane));
+
+	// Screen pixels covered by one world unit at a distance of one unit
+	view.pixels_per_unit = viewport_size[3]
+		/ (2.f * tan(glm::radians(camera.vertical_fov_degrees) * 0.5f));
+
+	// Occlusion culling tests against the depth of the last drawn frame, if
+	// that was from another view or instances have moved since, this frame
+	// can be missing things and has to be drawn again
+	const bool gpu_driven = gpu_driven_ && gpu_program_ != 0;
+	const bool gpu_occlusion = gpu_driven && gpu_occlusion_;
+	if (gpu_occlusion && (!gpu_renderer_.isOcclusionUpToDate(view.view_projection)
+		|| pyramid_instances_revision_ != snapshot.instances_revision))
+	{
+		rendered_settled_ = false;
+	}
+	if (gpu_driven)
+		cullOnGpu(snapshot, view);
+
+	const SceneUniforms& uniforms = gpu_driven ? gpu_uniforms_ : uniforms_;
+	glUseProgram(gpu_driven ? gpu_program_ : shader_program_);
 
-	auto ProjectionLocation = glGetUniformLocation(shader_program_, "projection_xform");
-	glUniformMatrix4fv(ProjectionLocation, 1, GL_FALSE, glm::value_ptr(projection_xform));
+	//Sent matrices to the GPU via a uniform.
+	glUniformMatrix4fv(uniforms.view_xform, 1, GL_FALSE, glm::value_ptr(view_xform));
+	glUniformMatrix4fv(uniforms.projection_xform, 1, GL_FALSE, glm::value_ptr(projection_xform));
+	glUniformMatrix4fv(uniforms.view_projection_xform, 1, GL_FALSE, glm::value_ptr(view.view_projection));
 
 	// Get light data from scene and then plug the values into the shader
-	auto lights = scene_->getAllLights();
-	auto LightLocation = glGetUniformLocation(shader_program_, "Lights");
-	for (size_t i = 0; i < lights.size(); i++)
+	const auto& lights = snapshot.lights;
+	const size_t point_light_count = glm::min(lights.size(), (size_t)kSpotLight);
+	for (size_t i = 0; i < point_light_count; i++)
 	{
-		//position
-		std::string name = "Lights[" + std::to_string(i) + "].position";
-		GLuint positionLocation = glGetUniformLocation(shader_program_, name.c_str());
-		glUniform3f(positionLocation, lights[i].getPosition().x, lights[i].getPosition().y, lights[i].getPosition().z);
-
-		//intensity
-		name = "Lights[" + std::to_string(i) + "].intensity";
-		GLuint intensityLocation = glGetUniformLocation(shader_program_, name.c_str());
-		glUniform3f(intensityLocation, lights[i].getIntensity().x, lights[i].getIntensity().y, lights[i].getIntensity().z);
-
-		//range
-		name = "Lights[" + std::to_string(i) + "].range";
-		GLuint rangeLocation = glGetUniformLocation(shader_program_, name.c_str());
-		glUniform1f(rangeLocation, lights[i].getRange());
+		const auto& light_uniforms = uniforms.lights[i];
+		glUniform3f(light_uniforms.position, lights[i].position.x, lights[i].position.y, lights[i].position.z);
+		glUniform3f(light_uniforms.intensity, lights[i].intensity.x, lights[i].intensity.y, lights[i].intensity.z);
+		glUniform1f(light_uniforms.range, lights[i].range);
 	}
 
 	//Spot Light positioned in the center of the scene which points down and rotaes back and forth
-	//position
-	std::string name = "Lights[22].position";
-	GLuint positionLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform3f(positionLocation, 0, 150, -5);
-	//intensity
-	name = "Lights[22].intensity";
-	GLuint intensityLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform3f(intensityLocation, .6, 0.3, 0.3);
+	const auto& spot_uniforms = uniforms.lights[kSpotLight];
+	glUniform3f(spot_uniforms.position, 0, 150, -5);
+	glUniform3f(spot_uniforms.intensity, .6, 0.3, 0.3);
 	//cone angle
-	name = "Lights[22].range";
-	GLuint rangeLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform1f(rangeLocation, 25);
-
+	glUniform1f(spot_uniforms.range, 25);
 	//direction of the spot light
-	name = "Lights[22].direction";
-	GLuint directionLocation = glGetUniformLocation(shader_program_, name.c_str());
-	float rotation = sin(scene_->getTimeInSeconds()) * 45;
-	glUniform3f(directionLocation, rotation, -90, 0);
-
+	float rotation = sin(light_time_seconds) * 45;
+	glUniform3f(spot_uniforms.direction, rotation, -90, 0);
 
 	//Directional Light - A small directional light with low intensity
-	//position
-	name = "Lights[23].position";
-	positionLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform3f(positionLocation, 0, 150, -5);
-	//intensity
-	name = "Lights[23].intensity";
-	intensityLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform3f(intensityLocation, 0.1, 0.15, 0.2);
-	//direction
-	name = "Lights[23].direction";
-	directionLocation = glGetUniformLocation(shader_program_, name.c_str());
-	glUniform3f(directionLocation, 0, -10, 75);
+	const auto& directional_uniforms = uniforms.lights[kDirectionalLight];
+	glUniform3f(directional_uniforms.position, 0, 150, -5);
+	glUniform3f(directional_uniforms.intensity, 0.1, 0.15, 0.2);
+	glUniform3f(directional_uniforms.direction, 0, -10, 75);
 
 	//set ambient Intensity
-	GLuint ambientIntensityLocation = glGetUniformLocation(shader_program_, "ambientIntensityColour");
-	auto ambientIntensity = scene_->getAmbientLightIntensity();
-	glUniform3f(ambientIntensityLocation, ambientIntensity.x, ambientIntensity.y, ambientIntensity.z);
+	const auto& ambientIntensity = snapshot.ambient_intensity;
+	glUniform3f(uniforms.ambient_intensity, ambientIntensity.x, ambientIntensity.y, ambientIntensity.z);
 
 	//set cameraPos in shader
-	GLuint cameraPosLocation = glGetUniformLocation(shader_program_, "cameraPos");
-	glUniform3f(cameraPosLocation, camera_pos.x, camera_pos.y, camera_pos.z);
+	glUniform3f(uniforms.camera_pos, camera_pos.x, camera_pos.y, camera_pos.z);
+
+	glUniform1i(uniforms.baked_lighting, use_baked);
+	glUniform1i(uniforms.baked_irradiance_sampler, kBakedIrradianceTexture);
+	glActiveTexture(GL_TEXTURE0 + kBakedIrradianceTexture);
+	glBindTexture(GL_TEXTURE_BUFFER, use_baked ? baked_irradiance_texture_ : kNullId);
+
+	glUniform1i(uniforms.mat_diffuse_sampler, kDiffuseTexture);
+	glUniform1i(uniforms.mat_specular_sampler, kSpecularTexture);
+
+	if (gpu_driven)
+		drawOnGpu();
+	else
+		drawInstances(snapshot, view, use_baked);
+
+	//resolve the multisampled frame into the texture that gets presented
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, frame_fbo_);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolve_fbo_);
+	glBlitFramebuffer(0, 0, frame_width_, frame_height_,
+		0, 0, frame_width_, frame_height_,
+		gpu_occlusion ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT,
+		GL_NEAREST);
+
+	if (gpu_occlusion)
+	{
+		gpu_renderer_.buildDepthPyramid(resolve_depth_texture_, view.view_projection);
+		pyramid_instances_revision_ = snapshot.instances_revision;
+	}
 
-	// Loop through your mesh container e.g.
-	for (const auto& mesh : m_meshVector)
+	presentFrame();
+
+	checkFrameAllocations(allocations_at_start);
+}
+
+void MyView::drawInstances(const SceneSnapshot & snapshot, const FrameView & view, bool use_baked)
+{
+	// Cull the instances of the snapshot into a draw list that lives in the
+	// frame arena, while at it work out which mips the visible ones need
+	DrawList draw_list{ FrameAllocator<DrawItem>(frame_arena_) };
+	buildDrawList(draw_list, snapshot.instances.size(), [&](DrawItem& item)
 	{
-		// Each mesh can be repeated in the scene so we need to ask the scene for all instances of the mesh
-		// and render each instance with its own model matrix
-		// To get the instances we need to use the meshId we stored earlier e.g.
-		const auto& instances = scene_->getInstancesByMeshId(mesh.mesh_id);
-		// loop through all instances
-		for each (auto& instance in instances)
+		const InstanceState& instance = snapshot.instances[item.instance_index];
+		const auto mesh_it = m_meshIndexById.find(instance.mesh_id);
+		const auto material_it = m_materialTextures.find(instance.material_id);
+		if (mesh_it == m_meshIndexById.end() || material_it == m_materialTextures.end())
+			return false;
+		const Mesh& mesh = m_meshVector[mesh_it->second];
+
+		//skip instances whose bounding sphere is outside the frustum
+		glm::vec3 centre;
+		float radius, scale;
+		worldBounds(mesh, instance.xform, centre, radius, scale);
+		if (!isInsideFrustum(view.frustum_planes, centre, radius))
+			return false;
+
+		// Ask for the mip where one texel covers about one pixel at the
+		// closest point of the instance
+		const float distance = glm::max(view.near_plane,
+			glm::distance(centre, view.camera_position) - radius);
+		const float texels_per_pixel = mesh.uv_density / scale
+			* distance / view.pixels_per_unit;
+		for (const int handle : { material_it->second.diffuse, material_it->second.specular })
 		{
-			//get the transform matrix
-			glm::mat4x3 transformMatrix = (glm::mat4x3&)scene_->getInstanceById(instance).getTransformationMatrix();
-			//sent to shader via unifrom
-			auto ProjectionViewModellocation = glGetUniformLocation(shader_program_, "projection_view_model_xform");
-			glm::mat4 modelViewProjection = view_projection * (glm::mat4)transformMatrix;
-			glUniformMatrix4fv(ProjectionViewModellocation, 1, GL_FALSE, glm::value_ptr(modelViewProjection));
-
-			auto ModelLocation = glGetUniformLocation(shader_program_, "model_xform");
-			glUniformMatrix4fv(ModelLocation, 1, GL_FALSE, glm::value_ptr((glm::mat4)transformMatrix));
-
-
-
-			// Materials
-			// Get material for this instance
-			const auto& material_id = scene_->getInstanceById(instance).getMaterialId();
-			const auto& material = scene_->getMaterialById(material_id);
-
-			GLuint matAmbientLocation = glGetUniformLocation(shader_program_, "mat.ambient_colour");
-			glUniform3f(matAmbientLocation, material.getAmbientColour().x, material.getAmbientColour().y, material.getAmbientColour().z);
-			GLuint matDiffuseLocation = glGetUniformLocation(shader_program_, "mat.diffuse_colour");
-			glUniform3f(matDiffuseLocation, material.getDiffuseColour().x, material.getDiffuseColour().y, material.getDiffuseColour().z);
-			GLuint matSpecularLocation = glGetUniformLocation(shader_program_, "mat.specular_colour");
-			glUniform3f(matSpecularLocation, material.getSpecularColour().x, material.getSpecularColour().y, material.getSpecularColour().z);
-			GLuint matShininessLocation = glGetUniformLocation(shader_program_, "mat.shininess");
-			glUniform1f(matShininessLocation, material.getShininess());
-
-			//reset bound textures by setting them to 0
-			glActiveTexture(GL_TEXTURE0 + kDiffuseTexture);
-			glBindTexture(GL_TEXTURE_2D, 0);
-			glActiveTexture(GL_TEXTURE0 + kSpecularTexture);
-			glBindTexture(GL_TEXTURE_2D, 0);
-
-			GLuint matHasTexture = glGetUniformLocation(shader_program_, "mat.hasDiffuse");
-			//check if material has a diffuse texture
-			if (!material.getDiffuseTexture().empty())
-			{
-				//bind diffuse texture
-				glActiveTexture(GL_TEXTURE0 + kDiffuseTexture);
-				glBindTexture(GL_TEXTURE_2D, m_textures[material.getDiffuseTexture()]);
-				glUniform1f(matHasTexture, true);
-			}
-			else
-			{
-				//no diffuse
-				glUniform1f(matHasTexture, false);
-			}
-
-			//check if material has a specular texture
-			matHasTexture = glGetUniformLocation(shader_program_, "mat.hasSpecular");
-			if (!material.getSpecularTexture().empty())
-			{
-				//bind specular texture
-				glActiveTexture(GL_TEXTURE0 + kSpecularTexture);
-				glBindTexture(GL_TEXTURE_2D, m_textures[material.getSpecularTexture()]);
-				glUniform1f(matHasTexture, true);
-			}
-			else
-			{
-				//no specular texture
-				glUniform1f(matHasTexture, false);
-			}
+			if (handle == TextureStreamer::kInvalidHandle)
+				continue;
+			const float texels = texels_per_pixel * texture_streamer_.textureSize(handle);
+			texture_streamer_.requestLevel(handle, (int)glm::log2(glm::max(texels, 1.f)));
+		}
 
-			GLuint diffuse_sampler_id = glGetUniformLocation(shader_program_, "mat.diffuse_sampler");
-			glUniform1i(diffuse_sampler_id, kDiffuseTexture);
-			GLuint specular_sampler_id = glGetUniformLocation(shader_program_, "mat.specular_sampler");
-			glUniform1i(specular_sampler_id, kSpecularTexture);
+		item.mesh_index = (int)mesh_it->second;
+		item.material_index = material_it->second.index;
+		return true;
+	});
 
+	int bound_mesh = -1;
+	int bound_material = -1;
+	const auto& baked_offsets = light_baker_.instanceOffsets();
+	for (const auto& item : draw_list)
+	{
+		const Mesh& mesh = m_meshVector[item.mesh_index];
+
+		//get the transform matrix and sent to shader via unifrom
+		const glm::mat4x3& transformMatrix = snapshot.instances[item.instance_index].xform;
+		glm::mat4 modelViewProjection = view.view_projection * (glm::mat4)transformMatrix;
+		glUniformMatrix4fv(uniforms_.projection_view_model_xform, 1, GL_FALSE, glm::value_ptr(modelViewProjection));
+		glUniformMatrix4fv(uniforms_.model_xform, 1, GL_FALSE, glm::value_ptr((glm::mat4)transformMatrix));
+		if (use_baked && item.instance_index < baked_offsets.size())
+			glUniform1i(uniforms_.baked_offset, baked_offsets[item.instance_index]);
+
+		// Materials
+		if (item.material_index != bound_material)
+		{
+			bound_material = item.material_index;
+			bindMaterial(uniforms_, m_materialTextures.find(m_materialIds[bound_material])->second);
+		}
 
-			// Finally you render the mesh e.g.
+		// Finally you render the mesh e.g.
+		if (item.mesh_index != bound_mesh)
+		{
+			bound_mesh = item.mesh_index;
 			glBindVertexArray(mesh.vao);
-			glDrawElements(GL_TRIANGLES, mesh.element_count, GL_UNSIGNED_INT, 0);
 		}
+		glDrawElements(GL_TRIANGLES, mesh.element_count, GL_UNSIGNED_INT, 0);
+	}
+	glBindVertexArray(kNullId);
+}
+
+void MyView::bindMaterial(const SceneUniforms & uniforms, const MaterialTextures & textures)
+{
+	const MaterialState& material = *textures.material;
+
+	glUniform3f(uniforms.mat_ambient_colour, material.ambient_colour.x, material.ambient_colour.y, material.ambient_colour.z);
+	glUniform3f(uniforms.mat_diffuse_colour, material.diffuse_colour.x, material.diffuse_colour.y, material.diffuse_colour.z);
+	glUniform3f(uniforms.mat_specular_colour, material.specular_colour.x, material.specular_colour.y, material.specular_colour.z);
+	glUniform1f(uniforms.mat_shininess, material.shininess);
+
+	//bind the textures, 0 unbinds them when the material has none
+	glActiveTexture(GL_TEXTURE0 + kDiffuseTexture);
+	glBindTexture(GL_TEXTURE_2D, texture_streamer_.textureId(textures.diffuse));
+	glUniform1f(uniforms.mat_has_diffuse, textures.diffuse != TextureStreamer::kInvalidHandle);
+
+	glActiveTexture(GL_TEXTURE0 + kSpecularTexture);
+	glBindTexture(GL_TEXTURE_2D, texture_streamer_.textureId(textures.specular));
+	glUniform1f(uniforms.mat_has_specular, textures.specular != TextureStreamer::kInvalidHandle);
+}
+
+void MyView::updateGpuInstances(const SceneSnapshot & snapshot, bool use_baked)
+{
+	//the instances carry their offsets into the bake, so they are uploaded
+	//again when the bake starts or stops applying too
+	if (snapshot.instances_revision != gpu_instances_revision_ || use_baked != gpu_instances_baked_)
+	{
+		const auto& baked_offsets = light_baker_.instanceOffsets();
+		gpu_instances_.clear();
+		for (size_t i = 0; i < snapshot.instances.size(); i++)
+		{
+			const InstanceState& instance = snapshot.instances[i];
+			const auto mesh_it = m_meshIndexById.find(instance.mesh_id);
+			const auto material_it = m_materialTextures.find(instance.material_id);
+			if (mesh_it == m_meshIndexById.end() || material_it == m_materialTextures.end())
+				continue;
+
+			GpuDrivenRenderer::Instance gpu_instance;
+			gpu_instance.mesh_index = (int)mesh_it->second;
+			gpu_instance.material_index = material_it->second.index;
+			gpu_instance.xform = instance.xform;
+			gpu_instance.baked_offset = use_baked && i < baked_offsets.size() ? baked_offsets[i] : 0;
+			gpu_instances_.push_back(gpu_instance);
+		}
+		gpu_renderer_.setInstances(gpu_instances_);
+		gpu_instances_revision_ = snapshot.instances_revision;
+		gpu_instances_baked_ = use_baked;
+	}
+}
+
+void MyView::cullOnGpu(const SceneSnapshot & snapshot, const FrameView & view)
+{
+	gpu_renderer_.cull(view, gpu_occlusion_);
+
+	// The GPU reports the mip demand of each material a frame or two late,
+	// which is soon enough for streaming
+	const auto& demand = gpu_renderer_.materialDemand();
+	for (size_t i = 0; i < m_materialIds.size(); i++)
+	{
+		if (std::isinf(demand[i]))
+			continue;
+		const MaterialTextures& textures = m_materialTextures.find(m_materialIds[i])->second;
+		for (const int handle : { textures.diffuse, textures.specular })
+		{
+			if (handle == TextureStreamer::kInvalidHandle)
+				continue;
+			const float texels = demand[i] * texture_streamer_.textureSize(handle);
+			texture_streamer_.requestLevel(handle, (int)glm::log2(glm::max(texels, 1.f)));
+		}
+	}
+
+	if (gpu_validation_)
+		validateGpuCulling(snapshot, view);
+}
+
+void MyView::drawOnGpu()
+{
+	gpu_renderer_.bindGeometry();
+	for (size_t i = 0; i < m_materialIds.size(); i++)
+	{
+		bindMaterial(gpu_uniforms_, m_materialTextures.find(m_materialIds[i])->second);
+		gpu_renderer_.drawMaterial((int)i);
+	}
+	glBindVertexArray(kNullId);
+}
+
+void MyView::validateGpuCulling(const SceneSnapshot & snapshot, const FrameView & view)
+{
+	gpu_renderer_.readVisibleCounts(gpu_visible_counts_);
+
+	// An instance right on a frustum plane can go either way on the GPU, so
+	// the CPU counts what is certainly and what is possibly visible
+	const size_t material_count = m_materialIds.size();
+	cpu_visible_counts_.assign(material_count + 1, 0);
+	cpu_possible_counts_.assign(material_count + 1, 0);
+	for (const auto& instance : snapshot.instances)
+	{
+		const auto mesh_it = m_meshIndexById.find(instance.mesh_id);
+		const auto material_it = m_materialTextures.find(instance.material_id);
+		if (mesh_it == m_meshIndexById.end() || material_it == m_materialTextures.end())
+			continue;
+
+		glm::vec3 centre;
+		float radius, scale;
+		worldBounds(m_meshVector[mesh_it->second], instance.xform, centre, radius, scale);
+		const float margin = 1e-3f * (radius + 1.f);
+		const size_t index = material_it->second.index;
+		if (isInsideFrustum(view.frustum_planes, centre, radius - margin))
+		{
+			cpu_visible_counts_[index]++;
+			cpu_visible_counts_[material_count]++;
+		}
+		if (isInsideFrustum(view.frustum_planes, centre, radius + margin))
+		{
+			cpu_possible_counts_[index]++;
+			cpu_possible_counts_[material_count]++;
+		}
+	}
+
+	// Occlusion culling can only ever remove more
+	for (size_t i = 0; i <= material_count; i++)
+	{
+		const unsigned int gpu_count = gpu_visible_counts_[i];
+		const bool valid = gpu_count <= cpu_possible_counts_[i]
+			&& (gpu_occlusion_ || gpu_count >= cpu_visible_counts_[i]);
+		if (valid)
+			continue;
+
+		if (gpu_validation_failures_++ < 10)
+		{
+			std::cerr << "GPU cull mismatch for ";
+			if (i == material_count)
+				std::cerr << "all materials";
+			else
+				std::cerr << "material " << m_materialIds[i];
+			std::cerr << ": GPU drew " << gpu_count << ", CPU expected "
+				<< cpu_visible_counts_[i] << " to " << cpu_possible_counts_[i] << std::endl;
+		}
+	}
+
+	const GLenum error = glGetError();
+	if (error != GL_NO_ERROR)
+	{
+		gpu_validation_failures_++;
+		std::cerr << "GL error during GPU driven frame: 0x" << std::hex << error << std::dec << std::endl;
+	}
+}
+
+void MyView::updateBakedLighting(const SceneSnapshot & snapshot)
+{
+	if (!bake_started_)
+	{
+		// Bake against the first snapshot, only the point lights are static
+		std::vector<LightBaker::Instance> instances(snapshot.instances.size());
+		for (size_t i = 0; i < snapshot.instances.size(); i++)
+		{
+			const auto mesh_it = m_meshIndexById.find(snapshot.instances[i].mesh_id);
+			instances[i].mesh_index = mesh_it != m_meshIndexById.end() ? (int)mesh_it->second : -1;
+			instances[i].xform = snapshot.instances[i].xform;
+		}
+		const size_t point_light_count = glm::min(snapshot.lights.size(), (size_t)kSpotLight);
+		const std::vector<LightState> lights(snapshot.lights.begin(),
+			snapshot.lights.begin() + point_light_count);
+
+		light_baker_.start(instances, lights, kSceneCachePath);
+		baked_instances_revision_ = snapshot.instances_revision;
+		bake_started_ = true;
+		return;
+	}
+
+	if (bake_ready_ || !baked_lighting_ || !light_baker_.isFinished())
+		return;
+
+	const auto& irradiance = light_baker_.irradiance();
+	GLint max_texels = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &max_texels);
+	if (irradiance.size() > (size_t)max_texels)
+	{
+		std::cerr << "Baked lighting has " << irradiance.size()
+			<< " vertices but texture buffers are limited to " << max_texels << std::endl;
+		baked_lighting_ = false;
+		return;
+	}
+
+	glGenBuffers(1, &baked_irradiance_buffer_);
+	glBindBuffer(GL_TEXTURE_BUFFER, baked_irradiance_buffer_);
+	glBufferData(GL_TEXTURE_BUFFER, irradiance.size() * sizeof(glm::vec4), irradiance.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_TEXTURE_BUFFER, kNullId);
+
+	glGenTextures(1, &baked_irradiance_texture_);
+	glBindTexture(GL_TEXTURE_BUFFER, baked_irradiance_texture_);
+	glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, baked_irradiance_buffer_);
+	glBindTexture(GL_TEXTURE_BUFFER, kNullId);
+
+	bake_ready_ = true;
+	invalidate();
+}
+
+void MyView::presentFrame()
+{
+	glBindFramebuffer(GL_FRAMEBUFFER, kNullId);
+	glDisable(GL_DEPTH_TEST);
+
+	glUseProgram(present_program_);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, resolve_texture_);
+	glUniform1i(present_frame_sampler_, 0);
+
+	glBindVertexArray(present_vao_);
+	glDrawArrays(GL_TRIANGLES, 0, 3);
+	glBindVertexArray(kNullId);
+}
+
+void MyView::checkFrameAllocations(std::uint64_t allocations_at_start)
+{
+	if (!AllocationTracker::isEnabled())
+		return;
+
+	// Once warmed up the render path must not touch the heap, every
+	// container it needs either lives in the frame arena or keeps its capacity
+	last_frame_allocations_ = AllocationTracker::threadAllocationCount() - allocations_at_start;
+	frames_tracked_++;
+	if (frames_tracked_ > kAllocationWarmupFrames && last_frame_allocations_ > 0)
+	{
+		if (steady_state_allocating_frames_++ == 0)
+		{
+			std::cerr << "Render path made " << last_frame_allocations_
+				<< " heap allocations in frame " << frames_tracked_ << std::endl;
+		}
+		assert(!"render path allocated after warming up");
+	}
+}
+
+void MyView::resizeFrameBuffers(int width, int height)
+{
+	frame_width_ = width;
+	frame_height_ = height;
+
+	//match the multisampling the window was opened with
+	glBindFramebuffer(GL_FRAMEBUFFER, kNullId);
+	GLint samples = 0;
+	glGetIntegerv(GL_SAMPLES, &samples);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, frame_colour_rbo_);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, frame_depth_rbo_);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, kNullId);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, frame_fbo_);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, frame_colour_rbo_);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, frame_depth_rbo_);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "Frame framebuffer is not complete" << std::endl;
+
+	glBindTexture(GL_TEXTURE_2D, resolve_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, kNullId);
+
+	//the resolved depth is what the GPU driven path builds its depth pyramid from
+	glBindTexture(GL_TEXTURE_2D, resolve_depth_texture_);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, width, height, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, nullptr);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, kNullId);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, resolve_fbo_);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, resolve_texture_, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, resolve_depth_texture_, 0);
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+		std::cerr << "Resolve framebuffer is not complete" << std::endl;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, kNullId);
+
+	if (gpu_program_ != 0)
+		gpu_renderer_.resize(width, height);
+}
+
+void MyView::lookupUniforms(GLuint program, SceneUniforms & uniforms)
+{
+	uniforms.view_xform = glGetUniformLocation(program, "view_xform");
+	uniforms.projection_xform = glGetUniformLocation(program, "projection_xform");
+	uniforms.view_projection_xform = glGetUniformLocation(program, "view_projection_xform");
+	uniforms.projection_view_model_xform = glGetUniformLocation(program, "projection_view_model_xform");
+	uniforms.model_xform = glGetUniformLocation(program, "model_xform");
+	uniforms.ambient_intensity = glGetUniformLocation(program, "ambientIntensityColour");
+	uniforms.camera_pos = glGetUniformLocation(program, "cameraPos");
+	uniforms.baked_lighting = glGetUniformLocation(program, "baked_lighting");
+	uniforms.baked_irradiance_sampler = glGetUniformLocation(program, "baked_irradiance_sampler");
+	uniforms.baked_offset = glGetUniformLocation(program, "baked_offset");
+
+	uniforms.mat_ambient_colour = glGetUniformLocation(program, "mat.ambient_colour");
+	uniforms.mat_diffuse_colour = glGetUniformLocation(program, "mat.diffuse_colour");
+	uniforms.mat_specular_colour = glGetUniformLocation(program, "mat.specular_colour");
+	uniforms.mat_shininess = glGetUniformLocation(program, "mat.shininess");
+	uniforms.mat_has_diffuse = glGetUniformLocation(program, "mat.hasDiffuse");
+	uniforms.mat_has_specular = glGetUniformLocation(program, "mat.hasSpecular");
+	uniforms.mat_diffuse_sampler = glGetUniformLocation(program, "mat.diffuse_sampler");
+	uniforms.mat_specular_sampler = glGetUniformLocation(program, "mat.specular_sampler");
+
+	for (int i = 0; i < kLightCount; i++)
+	{
+		const std::string name = "Lights[" + std::to_string(i) + "].";
+		uniforms.lights[i].position = glGetUniformLocation(program, (name + "position").c_str());
+		uniforms.lights[i].intensity = glGetUniformLocation(program, (name + "intensity").c_str());
+		uniforms.lights[i].direction = glGetUniformLocation(program, (name + "direction").c_str());
+		uniforms.lights[i].range = glGetUniformLocation(program, (name + "range").c_str());
+	}
+}
+
+void MyView::worldBounds(const Mesh & mesh, const glm::mat4x3 & xform, glm::vec3 & centre, float & radius, float & scale) const
+{
+	centre = xform * glm::vec4(mesh.bounds_centre, 1.f);
+	scale = glm::max(glm::length(xform[0]),
+		glm::max(glm::length(xform[1]), glm::length(xform[2])));
+	radius = mesh.bounds_radius * scale;
+}
+
+void MyView::computeMeshBounds(Mesh & mesh, const std::vector<Vertex> & vertices, const std::vector<unsigned int> & elements)
+{
+	if (vertices.empty())
+		return;
+
+	glm::vec3 min_position = vertices[0].position;
+	glm::vec3 max_position = vertices[0].position;
+	for (const auto& vertex : vertices)
+	{
+		min_position = glm::min(min_position, vertex.position);
+		max_position = glm::max(max_position, vertex.position);
+	}
+	mesh.bounds_centre = (min_position + max_position) * 0.5f;
+	for (const auto& vertex : vertices)
+		mesh.bounds_radius = glm::max(mesh.bounds_radius, glm::distance(mesh.bounds_centre, vertex.position));
+
+	//ratio of the area the triangles cover in texture space to model space
+	float uv_area = 0.f;
+	float surface_area = 0.f;
+	for (size_t i = 0; i + 2 < elements.size(); i += 3)
+	{
+		const Vertex& a = vertices[elements[i]];
+		const Vertex& b = vertices[elements[i + 1]];
+		const Vertex& c = vertices[elements[i + 2]];
+		surface_area += glm::length(glm::cross(b.position - a.position, c.position - a.position));
+		const glm::vec2 uv_ab = b.texCoord - a.texCoord;
+		const glm::vec2 uv_ac = c.texCoord - a.texCoord;
+		uv_area += glm::abs(uv_ab.x * uv_ac.y - uv_ab.y * uv_ac.x);
+	}
+	if (surface_area > 0.f)
+		mesh.uv_density = glm::sqrt(uv_area / surface_area);
+}
+
+GLuint MyView::compileShader(GLenum type, const std::string & path)
+{
+	GLint compile_status = GL_FALSE;
+
+	GLuint shader = glCreateShader(type);
+	std::string shader_string = tygra::createStringFromFile(path);
+	const char * shader_code = shader_string.c_str();
+	glShaderSource(shader, 1, (const GLchar **)&shader_code, NULL);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compile_status);
+	if (compile_status != GL_TRUE)
+	{
+		const int string_length = 1024;
+		GLchar log[string_length] = "";
+		glGetShaderInfoLog(shader, string_length, NULL, log);
+		std::cerr << log << std::endl;
+	}
+	return shader;
+}
+
+void MyView::linkProgram(GLuint program)
+{
+	glLinkProgram(program);
+
+	GLint link_status = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &link_status);
+	if (link_status != GL_TRUE)
+	{
+		const int string_length = 1024;
+		GLchar log[string_length] = "";
+		glGetProgramInfoLog(program, string_length, NULL, log);
+		std::cerr << log << std::endl;
 	}
 }
 
@@ -384,31 +1002,3 @@ void MyView::buildMesh(Mesh & mesh,int meshID, std::vector<Vertex> vertices, std
 	glBindBuffer(GL_ARRAY_BUFFER, kNullId);
 	glBindVertexArray(kNullId);
 }
-
-void MyView::createTexture(const std::string & path, GLuint & texID)
-{
-	tygra::Image texture_image
-		= tygra::createImageFromPngFile(path);
-	if (texture_image.doesContainData()) {
-		glGenTextures(1, &texID);
-		glBindTexture(GL_TEXTURE_2D, texID);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-			GL_LINEAR_MIPMAP_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-		GLenum pixel_formats[] = { 0, GL_RED, GL_RG, GL_RGB, GL_RGBA };
-		glTexImage2D(GL_TEXTURE_2D,
-			0,
-			GL_RGBA,
-			texture_image.width(),
-			texture_image.height(),
-			0,
-			pixel_formats[texture_image.componentsPerPixel()],
-			texture_image.bytesPerComponent() == 1
-			? GL_UNSIGNED_BYTE : GL_UNSIGNED_SHORT,
-			texture_image.pixelData());
-		glGenerateMipmap(GL_TEXTURE_2D);
-		glBindTexture(GL_TEXTURE_2D, kNullId);
-	}
-}
\ No newline at end of file
@@ -1,14 +1,27 @@
 #pragma once
 
+#include "DrawList.hpp"
+#include "FrameArena.hpp"
+#include "GpuDrivenRenderer.hpp"
+#include "LightBaker.hpp"
+#include "TextureStreamer.hpp"
+
 #include <sponza/sponza_fwd.hpp>
 #include <tygra/WindowViewDelegate.hpp>
 #include <tgl/tgl.h>
 #include <glm/glm.hpp>
 #include <unordered_map>
 
+#include <atomic>
+#include <cstdint>
+#include <string>
 #include <vector>
 #include <memory>
 
+class Simulation;
+struct InstanceState;
+struct SceneSnapshot;
+
 class MyView : public tygra::WindowViewDelegate
 {
 public:
@@ -19,6 +32,40 @@ public:
     
     void setScene(const sponza::Context * scene);
 
+    void setSimulation(Simulation * simulation);
+
+    // Forces the next frame to be rendered even if nothing changed
+    void invalidate();
+
+    bool lastFrameWasSkipped() const { return last_frame_skipped_; }
+
+    std::uint64_t renderedRevision() const { return rendered_revision_; }
+
+    std::uint64_t framesRendered() const { return frames_rendered_; }
+
+    std::uint64_t framesSkipped() const { return frames_skipped_; }
+
+    // Culls and builds the draw commands on the GPU, ignored when the
+    // context is older than GL 4.3
+    void setGpuDriven(bool enabled);
+
+    bool isGpuDriven() const { return gpu_driven_; }
+
+    // Occlusion culls against the previous frame's depth in GPU driven mode
+    void setOcclusionCulling(bool enabled);
+
+    bool isOcclusionCulling() const { return gpu_occlusion_; }
+
+    // Checks every GPU cull against the CPU frustum test, this stalls
+    void setGpuValidation(bool enabled);
+
+    bool isGpuValidation() const { return gpu_validation_; }
+
+    // Uses the baked diffuse light of the point lights once the bake is done
+    void setBakedLighting(bool enabled);
+
+    bool isBakedLighting() const { return baked_lighting_; }
+
 private:
 
     void windowViewWillStart(tygra::Window * window) override;
@@ -33,17 +80,84 @@ private:
 
 private:
 
-    const sponza::Context * scene_;
+    Simulation * simulation_{ nullptr };
 
 	// Me from here down
 	GLuint shader_program_{ 0 };
 
+	// Render on demand, the scene is drawn into frame_fbo_ and resolved into
+	// resolve_texture_ which is what gets drawn to the window. When nothing
+	// changed the resolve texture is drawn again instead of the scene.
+	GLuint present_program_{ 0 };
+	GLuint present_vao_{ 0 };
+	GLuint frame_fbo_{ 0 };
+	GLuint frame_colour_rbo_{ 0 };
+	GLuint frame_depth_rbo_{ 0 };
+	GLuint resolve_fbo_{ 0 };
+	GLuint resolve_texture_{ 0 };
+	GLuint resolve_depth_texture_{ 0 };
+	int frame_width_{ 0 };
+	int frame_height_{ 0 };
+
+	std::atomic<bool> invalidated_{ true };
+	std::uint64_t rendered_revision_{ 0 };
+	bool rendered_settled_{ false };
+	bool last_frame_skipped_{ false };
+	std::uint64_t frames_rendered_{ 0 };
+	std::uint64_t frames_skipped_{ 0 };
+
 	const static GLuint kNullId = 0;
 
+	// Matches the Lights array in sponza_fs.glsl, the point lights of the
+	// scene come first and the two extra lights go in the last slots
+	static const int kLightCount = 24;
+	static const int kSpotLight = 22;
+	static const int kDirectionalLight = 23;
+
+	// Uniform locations are looked up once after linking so the render loop
+	// never builds names or asks GL for them
+	struct LightUniforms
+	{
+		GLint position{ -1 };
+		GLint intensity{ -1 };
+		GLint direction{ -1 };
+		GLint range{ -1 };
+	};
+
+	struct SceneUniforms
+	{
+		GLint view_xform{ -1 };
+		GLint projection_xform{ -1 };
+		GLint view_projection_xform{ -1 };
+		GLint projection_view_model_xform{ -1 };
+		GLint model_xform{ -1 };
+		GLint ambient_intensity{ -1 };
+		GLint camera_pos{ -1 };
+		GLint baked_lighting{ -1 };
+		GLint baked_irradiance_sampler{ -1 };
+		GLint baked_offset{ -1 };
+
+		GLint mat_ambient_colour{ -1 };
+		GLint mat_diffuse_colour{ -1 };
+		GLint mat_specular_colour{ -1 };
+		GLint mat_shininess{ -1 };
+		GLint mat_has_diffuse{ -1 };
+		GLint mat_has_specular{ -1 };
+		GLint mat_diffuse_sampler{ -1 };
+		GLint mat_specular_sampler{ -1 };
+
+		LightUniforms lights[kLightCount];
+	};
+
+	SceneUniforms uniforms_;
+	SceneUniforms gpu_uniforms_;
+	GLint present_frame_sampler_{ -1 };
+
 	// TODO: define values for your Vertex attributes
 	int kVertexPosition = 0;
 	int kVertexNormal = 1;
 	int kVertexUV = 3;
+	int kVertexInstance = 4;
 
 	struct Vertex {
 		glm::vec3 position;
@@ -66,17 +180,115 @@ private:
 
 		// Needed for when we draw using the vertex arrays
 		int element_count{ 0 };
+
+		// Bounding sphere in model space
+		glm::vec3 bounds_centre{ 0, 0, 0 };
+		float bounds_radius{ 0.f };
+
+		// Texture coordinate units per model space unit, used to pick the
+		// mip level a texture needs on screen
+		float uv_density{ 0.f };
 	};
 
 	enum TextureIndexes {
 		kDiffuseTexture = 0,
-		kSpecularTexture = 1
+		kSpecularTexture = 1,
+		kBakedIrradianceTexture = 2
 	};
 
+	GLuint compileShader(GLenum type, const std::string & path);
+	void linkProgram(GLuint program);
+	void lookupUniforms(GLuint program, SceneUniforms & uniforms);
+
+	void resizeFrameBuffers(int width, int height);
+	void presentFrame();
+	void checkFrameAllocations(std::uint64_t allocations_at_start);
+
+	typedef GpuDrivenRenderer::CullParameters FrameView;
+
+	void drawInstances(const SceneSnapshot & snapshot, const FrameView & view, bool use_baked);
+	void updateGpuInstances(const SceneSnapshot & snapshot, bool use_baked);
+	void cullOnGpu(const SceneSnapshot & snapshot, const FrameView & view);
+	void drawOnGpu();
+	void validateGpuCulling(const SceneSnapshot & snapshot, const FrameView & view);
+	void updateBakedLighting(const SceneSnapshot & snapshot);
+
 	void buildMesh(Mesh & mesh, int meshID, std::vector<Vertex> vertices, std::vector<unsigned int> elements);
-	void createTexture(const std::string & path, GLuint & texID);
+	void computeMeshBounds(Mesh & mesh, const std::vector<Vertex> & vertices, const std::vector<unsigned int> & elements);
+	void worldBounds(const Mesh & mesh, const glm::mat4x3 & xform, glm::vec3 & centre, float & radius, float & scale) const;
 
 	// TODO: create a container of these mesh e.g.
 	std::vector<Mesh> m_meshVector;
-	std::unordered_map<std::string, GLuint> m_textures;
+	//maps a sponza mesh id to its index in m_meshVector
+	std::unordered_map<int, size_t> m_meshIndexById;
+	//maps a texture path to its TextureStreamer handle
+	std::unordered_map<std::string, int> m_textures;
+
+	// Copy of a sponza material, taken before the simulation thread starts
+	// so the render thread never reads the scene
+	struct MaterialState
+	{
+		int id{ 0 };
+		glm::vec3 ambient_colour{ 0, 0, 0 };
+		glm::vec3 diffuse_colour{ 0, 0, 0 };
+		glm::vec3 specular_colour{ 0, 0, 0 };
+		float shininess{ 0.f };
+		std::string diffuse_texture;
+		std::string specular_texture;
+	};
+	std::vector<MaterialState> m_materials;
+
+	struct MaterialTextures
+	{
+		const MaterialState * material{ nullptr };
+		int diffuse{ TextureStreamer::kInvalidHandle };
+		int specular{ TextureStreamer::kInvalidHandle };
+		//index of the material in m_materialIds
+		int index{ -1 };
+	};
+	//maps a sponza material id to the handles of its textures
+	std::unordered_map<int, MaterialTextures> m_materialTextures;
+	//sponza material ids in the order the GPU driven path numbers them
+	std::vector<int> m_materialIds;
+
+	void bindMaterial(const SceneUniforms & uniforms, const MaterialTextures & textures);
+
+	// Transient per frame data, reset at the start of every frame
+	FrameArena frame_arena_{ 64 * 1024 };
+
+	// Allocation tracking, only active with SPONZA_TRACK_ALLOCATIONS
+	static const int kAllocationWarmupFrames = 60;
+	std::uint64_t frames_tracked_{ 0 };
+	std::uint64_t last_frame_allocations_{ 0 };
+	std::uint64_t steady_state_allocating_frames_{ 0 };
+
+	static const std::size_t kTextureBudgetBytes = 64 * 1024 * 1024;
+	TextureStreamer texture_streamer_{ kTextureBudgetBytes };
+
+	// GPU driven path, the instances are only uploaded again when the
+	// snapshot says they changed
+	GpuDrivenRenderer gpu_renderer_;
+	GLuint gpu_program_{ 0 };
+	bool gpu_driven_{ false };
+	bool gpu_occlusion_{ true };
+	bool gpu_validation_{ false };
+	std::uint64_t gpu_instances_revision_{ 0 };
+	bool gpu_instances_baked_{ false };
+	std::uint64_t pyramid_instances_revision_{ 0 };
+	std::vector<GpuDrivenRenderer::Instance> gpu_instances_;
+	std::vector<unsigned int> gpu_visible_counts_;
+	std::vector<unsigned int> cpu_visible_counts_;
+	std::vector<unsigned int> cpu_possible_counts_;
+	std::uint64_t gpu_validation_failures_{ 0 };
+
+	// The point lights never move so their diffuse light is baked once per
+	// vertex in the background, until that finishes they are lit per pixel.
+	// The bake only holds for the instances it was made from.
+	LightBaker light_baker_;
+	bool baked_lighting_{ true };
+	bool bake_started_{ false };
+	bool bake_ready_{ false };
+	std::uint64_t baked_instances_revision_{ 0 };
+	GLuint baked_irradiance_buffer_{ 0 };
+	GLuint baked_irradiance_texture_{ 0 };
 };
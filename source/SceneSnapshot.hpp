@@ -0,0 +1,92 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// Immutable copy of the parts of sponza::Context that change while the
+// simulation runs. The simulation thread writes one of these every tick and
+// the render thread only ever reads from them.
+
+struct CameraState
+{
+	glm::vec3 position{ 0, 0, 0 };
+	glm::vec3 direction{ 0, 0, -1 };
+	float vertical_fov_degrees{ 60.f };
+	float near_plane{ 1.f };
+	float far_plane{ 1000.f };
+};
+
+struct LightState
+{
+	glm::vec3 position;
+	glm::vec3 intensity;
+	float range;
+};
+
+struct InstanceState
+{
+	int mesh_id;
+	int material_id;
+	glm::mat4x3 xform;
+};
+
+inline bool operator==(const CameraState & a, const CameraState & b)
+{
+	return a.position == b.position && a.direction == b.direction
+		&& a.vertical_fov_degrees == b.vertical_fov_degrees
+		&& a.near_plane == b.near_plane && a.far_plane == b.far_plane;
+}
+
+inline bool operator!=(const CameraState & a, const CameraState & b)
+{
+	return !(a == b);
+}
+
+inline bool operator==(const LightState & a, const LightState & b)
+{
+	return a.position == b.position && a.intensity == b.intensity
+		&& a.range == b.range;
+}
+
+inline bool operator==(const InstanceState & a, const InstanceState & b)
+{
+	return a.mesh_id == b.mesh_id && a.material_id == b.material_id
+		&& a.xform == b.xform;
+}
+
+struct SceneSnapshot
+{
+	std::uint64_t tick{ 0 };
+	std::chrono::steady_clock::time_point publish_time;
+
+	// Only bumped when something that affects the rendered image changed
+	// since the previous tick, a still scene keeps the same revision
+	std::uint64_t revision{ 0 };
+
+	// Only bumped when the instances changed, lets the GPU copy of them be
+	// refreshed without comparing every instance each frame
+	std::uint64_t instances_revision{ 0 };
+
+	// Clock driving the animated lights, stops while light animation is paused
+	float light_time_seconds{ 0.f };
+	CameraState camera;
+
+	// State at the tick before this one, the render thread blends from
+	// these towards the current values
+	float previous_light_time_seconds{ 0.f };
+	CameraState previous_camera;
+
+	glm::vec3 ambient_intensity{ 0, 0, 0 };
+
+	std::vector<LightState> lights;
+	std::vector<InstanceState> instances;
+
+	bool isMoving() const
+	{
+		return previous_camera != camera
+			|| previous_light_time_seconds != light_time_seconds;
+	}
+};
@@ -0,0 +1,262 @@
+#include "Simulation.hpp"
+
+#include <sponza/sponza.hpp>
+
+Simulation::Simulation(sponza::Context * scene) : scene_(scene)
+{
+}
+
+Simulation::~Simulation()
+{
+	stop();
+}
+
+Simulation::Clock::duration Simulation::tickDuration()
+{
+	return std::chrono::duration_cast<Clock::duration>(
+		std::chrono::duration<double>(1.0 / kTicksPerSecond));
+}
+
+float Simulation::interpolationFactor(const SceneSnapshot & snapshot,
+	Clock::time_point now)
+{
+	const float alpha = std::chrono::duration<float>(now - snapshot.publish_time).count()
+		* kTicksPerSecond;
+	return glm::clamp(alpha, 0.f, 1.f);
+}
+
+void Simulation::waitForChange(std::uint64_t seen_revision,
+	Clock::duration timeout)
+{
+	std::unique_lock<std::mutex> lock(change_mutex_);
+	change_condition_.wait_for(lock, timeout,
+		[&] { return revision_ != seen_revision || !running_; });
+}
+
+void Simulation::start()
+{
+	if (running_)
+		return;
+
+	//publish the initial state so the first frame has something to draw
+	last_scene_time_seconds_ = scene_->getTimeInSeconds();
+	publishSnapshot(Clock::now());
+
+	running_ = true;
+	thread_ = std::thread(&Simulation::run, this);
+}
+
+void Simulation::stop()
+{
+	running_ = false;
+	change_condition_.notify_all();
+	{
+		//taken so a parked thread can't miss the wake up between checking
+		//running_ and waiting
+		std::lock_guard<std::mutex> lock(input_mutex_);
+	}
+	input_condition_.notify_all();
+	if (thread_.joinable())
+		thread_.join();
+}
+
+void Simulation::pushInput(InputEvent::Type type, const glm::vec3 & value)
+{
+	InputEvent event;
+	event.timestamp = Clock::now();
+	event.type = type;
+	event.value = value;
+
+	{
+		std::lock_guard<std::mutex> lock(input_mutex_);
+		input_queue_.push_back(event);
+	}
+	input_condition_.notify_all();
+}
+
+void Simulation::run()
+{
+	const auto tick_duration = tickDuration();
+	auto next_tick = Clock::now();
+
+	while (running_)
+	{
+		next_tick += tick_duration;
+		std::this_thread::sleep_until(next_tick);
+
+		//if we fell far behind (e.g. a debugger break) don't try to catch up
+		const auto now = Clock::now();
+		if (now - next_tick > tick_duration * 4)
+			next_tick = now;
+
+		consumeInput(next_tick);
+
+		auto& camera = scene_->getCamera();
+		camera.setLinearVelocity(sponza::Vector3(linear_velocity_.x,
+			linear_velocity_.y, linear_velocity_.z));
+		camera.setRotationalVelocity(sponza::Vector2(
+			rotational_velocity_.x + rotational_impulse_.x,
+			rotational_velocity_.y + rotational_impulse_.y));
+
+		scene_->update();
+
+		const float scene_time_seconds = scene_->getTimeInSeconds();
+		if (animate_lights_)
+			light_time_seconds_ += scene_time_seconds - last_scene_time_seconds_;
+		last_scene_time_seconds_ = scene_time_seconds;
+
+		//impulses only last for the tick they arrived in
+		rotational_impulse_ = glm::vec3(0, 0, 0);
+		camera.setRotationalVelocity(sponza::Vector2(rotational_velocity_.x,
+			rotational_velocity_.y));
+
+		const bool changed = publishSnapshot(next_tick);
+
+		//nothing moved this tick and nothing will until new input arrives, so
+		//stop ticking instead of publishing the same snapshot 60 times a second
+		if (!changed && isIdle())
+		{
+			park();
+			next_tick = Clock::now();
+		}
+	}
+}
+
+bool Simulation::isIdle() const
+{
+	return !animate_lights_ && input_pending_.empty()
+		&& linear_velocity_ == glm::vec3(0, 0, 0)
+		&& rotational_velocity_ == glm::vec3(0, 0, 0)
+		&& rotational_impulse_ == glm::vec3(0, 0, 0);
+}
+
+void Simulation::park()
+{
+	{
+		std::unique_lock<std::mutex> lock(input_mutex_);
+		input_condition_.wait(lock,
+			[&] { return !input_queue_.empty() || !running_; });
+	}
+
+	//the scene clock kept running while parked, step it once with nothing
+	//moving so that time isn't applied to the camera or the lights
+	scene_->update();
+	last_scene_time_seconds_ = scene_->getTimeInSeconds();
+}
+
+void Simulation::consumeInput(Clock::time_point tick_time)
+{
+	{
+		std::lock_guard<std::mutex> lock(input_mutex_);
+		input_pending_.insert(input_pending_.end(),
+			input_queue_.begin(), input_queue_.end());
+		input_queue_.clear();
+	}
+
+	//only consume events that happened before this tick, anything newer
+	//belongs to the next one
+	size_t consumed = 0;
+	for (; consumed < input_pending_.size(); consumed++)
+	{
+		const auto& event = input_pending_[consumed];
+		if (event.timestamp > tick_time)
+			break;
+
+		switch (event.type)
+		{
+		case InputEvent::kLinearVelocity:
+			linear_velocity_ = event.value;
+			break;
+		case InputEvent::kRotationalVelocity:
+			rotational_velocity_ = event.value;
+			break;
+		case InputEvent::kRotationalImpulse:
+			rotational_impulse_ += event.value;
+			break;
+		case InputEvent::kLightAnimation:
+			animate_lights_ = event.value.x != 0.f;
+			break;
+		}
+	}
+	input_pending_.erase(input_pending_.begin(),
+		input_pending_.begin() + consumed);
+}
+
+bool Simulation::publishSnapshot(Clock::time_point tick_time)
+{
+	SceneSnapshot& snapshot = snapshots_.back();
+
+	snapshot.tick = tick_++;
+	snapshot.publish_time = tick_time;
+	snapshot.light_time_seconds = light_time_seconds_;
+
+	const auto& camera = scene_->getCamera();
+	snapshot.camera.position = (const glm::vec3&)camera.getPosition();
+	snapshot.camera.direction = (const glm::vec3&)camera.getDirection();
+	snapshot.camera.vertical_fov_degrees = camera.getVerticalFieldOfViewInDegrees();
+	snapshot.camera.near_plane = camera.getNearPlaneDistance();
+	snapshot.camera.far_plane = camera.getFarPlaneDistance();
+
+	snapshot.ambient_intensity = (const glm::vec3&)scene_->getAmbientLightIntensity();
+
+	//the vectors keep their capacity between ticks so this doesn't allocate
+	//once the buffers have been filled once
+	const auto& lights = scene_->getAllLights();
+	snapshot.lights.resize(lights.size());
+	for (size_t i = 0; i < lights.size(); i++)
+	{
+		snapshot.lights[i].position = (const glm::vec3&)lights[i].getPosition();
+		snapshot.lights[i].intensity = (const glm::vec3&)lights[i].getIntensity();
+		snapshot.lights[i].range = lights[i].getRange();
+	}
+
+	const auto& instances = scene_->getAllInstances();
+	snapshot.instances.resize(instances.size());
+	for (size_t i = 0; i < instances.size(); i++)
+	{
+		snapshot.instances[i].mesh_id = instances[i].getMeshId();
+		snapshot.instances[i].material_id = instances[i].getMaterialId();
+		snapshot.instances[i].xform = (const glm::mat4x3&)instances[i].getTransformationMatrix();
+	}
+
+	//anything that shows up on screen changing gives the snapshot a new
+	//revision, this is what lets the view skip frames of a still scene
+	const bool instances_changed = !has_published_
+		|| snapshot.instances != last_instances_;
+	const bool changed = instances_changed
+		|| snapshot.camera != last_camera_
+		|| snapshot.light_time_seconds != last_light_time_seconds_
+		|| snapshot.ambient_intensity != last_ambient_intensity_
+		|| snapshot.lights != last_lights_;
+	if (instances_changed)
+		instances_revision_++;
+	snapshot.instances_revision = instances_revision_;
+
+	if (!has_published_)
+	{
+		last_camera_ = snapshot.camera;
+		last_light_time_seconds_ = snapshot.light_time_seconds;
+		has_published_ = true;
+	}
+	snapshot.previous_camera = last_camera_;
+	snapshot.previous_light_time_seconds = last_light_time_seconds_;
+
+	last_camera_ = snapshot.camera;
+	last_light_time_seconds_ = snapshot.light_time_seconds;
+	last_ambient_intensity_ = snapshot.ambient_intensity;
+	last_lights_ = snapshot.lights;
+	last_instances_ = snapshot.instances;
+
+	{
+		std::lock_guard<std::mutex> lock(change_mutex_);
+		if (changed)
+			revision_++;
+		snapshot.revision = revision_;
+	}
+
+	snapshots_.publish();
+
+	if (changed)
+		change_condition_.notify_all();
+	return changed;
+}
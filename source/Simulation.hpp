@@ -0,0 +1,119 @@
+#pragma once
+
+#include "SceneSnapshot.hpp"
+#include "TripleBuffer.hpp"
+
+#include <sponza/sponza_fwd.hpp>
+#include <glm/glm.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Advances the sponza::Context on its own thread at a fixed tick and
+// publishes a SceneSnapshot after every tick. When nothing is moving or
+// animating the thread parks until the next input instead of ticking.
+// Once started, only the simulation thread touches the scene, so input has
+// to go through pushInput rather than writing to the scene directly and
+// anything else has to be copied from the scene before start().
+class Simulation
+{
+public:
+
+	typedef std::chrono::steady_clock Clock;
+
+	struct InputEvent
+	{
+		enum Type {
+			kLinearVelocity,     // held until changed, e.g. keys and thumbsticks
+			kRotationalVelocity, // held until changed, e.g. thumbsticks
+			kRotationalImpulse,  // applied for a single tick, e.g. mouse deltas
+			kLightAnimation      // value.x non zero to animate the lights
+		};
+
+		Clock::time_point timestamp;
+		Type type;
+		glm::vec3 value;
+	};
+
+	static const int kTicksPerSecond = 60;
+
+	explicit Simulation(sponza::Context * scene);
+
+	~Simulation();
+
+	void start();
+
+	void stop();
+
+	// Safe to call from any thread
+	void pushInput(InputEvent::Type type, const glm::vec3 & value);
+
+	// Only the render thread may read from this
+	TripleBuffer<SceneSnapshot> & snapshots() { return snapshots_; }
+
+	static Clock::duration tickDuration();
+
+	// How far the render thread is between the previous and current state
+	// of a snapshot, in the range [0, 1]
+	static float interpolationFactor(const SceneSnapshot & snapshot,
+		Clock::time_point now);
+
+	// Blocks until a snapshot with a revision other than seen_revision has
+	// been published or the timeout expires
+	void waitForChange(std::uint64_t seen_revision, Clock::duration timeout);
+
+private:
+
+	void run();
+
+	void consumeInput(Clock::time_point tick_time);
+
+	// Returns true if the snapshot got a new revision
+	bool publishSnapshot(Clock::time_point tick_time);
+
+	// True when the next tick can't change anything without new input
+	bool isIdle() const;
+
+	// Blocks until input is pushed or the simulation stops
+	void park();
+
+private:
+
+	sponza::Context * scene_{ nullptr };
+
+	std::thread thread_;
+	std::atomic<bool> running_{ false };
+	std::uint64_t tick_{ 0 };
+
+	std::mutex input_mutex_;
+	std::condition_variable input_condition_;
+	std::vector<InputEvent> input_queue_;
+	std::vector<InputEvent> input_pending_;
+
+	glm::vec3 linear_velocity_{ 0, 0, 0 };
+	glm::vec3 rotational_velocity_{ 0, 0, 0 };
+	glm::vec3 rotational_impulse_{ 0, 0, 0 };
+
+	bool animate_lights_{ true };
+	float light_time_seconds_{ 0.f };
+	float last_scene_time_seconds_{ 0.f };
+
+	// What was published last tick, used to tell if anything changed
+	bool has_published_{ false };
+	float last_light_time_seconds_{ 0.f };
+	CameraState last_camera_;
+	glm::vec3 last_ambient_intensity_{ 0, 0, 0 };
+	std::vector<LightState> last_lights_;
+	std::vector<InstanceState> last_instances_;
+
+	std::mutex change_mutex_;
+	std::condition_variable change_condition_;
+	std::uint64_t revision_{ 0 };
+	std::uint64_t instances_revision_{ 0 };
+
+	TripleBuffer<SceneSnapshot> snapshots_;
+};
@@ -0,0 +1,482 @@
+#include "TextureStreamer.hpp"
+
+#include <tygra/FileHelper.hpp>
+
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+
+// Never keep more loads queued than this, new requests are picked again
+// next frame anyway
+static const int kMaxLoadsInFlight = 8;
+
+// Uploads are spread over frames to avoid hitches
+static const int kMaxUploadsPerUpdate = 2;
+
+static const int kBytesPerTexel = 4;
+
+static const int kNotRequested = INT_MAX;
+
+static int mipSize(int size, int level)
+{
+	return std::max(1, size >> level);
+}
+
+TextureStreamer::TextureStreamer(std::size_t budget_bytes)
+	: budget_bytes_(budget_bytes)
+{
+}
+
+TextureStreamer::~TextureStreamer()
+{
+	stop();
+}
+
+void TextureStreamer::start()
+{
+	if (running_)
+		return;
+
+	running_ = true;
+	const unsigned int hardware_threads = std::thread::hardware_concurrency();
+	const unsigned int worker_count = std::max(1u, std::min(4u, hardware_threads > 1 ? hardware_threads - 1 : 1));
+	for (unsigned int i = 0; i < worker_count; i++)
+		workers_.push_back(std::thread(&TextureStreamer::workerLoop, this));
+}
+
+void TextureStreamer::stop()
+{
+	if (!running_)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		running_ = false;
+		jobs_.clear();
+	}
+	job_condition_.notify_all();
+	for (auto& worker : workers_)
+		worker.join();
+	workers_.clear();
+	results_.clear();
+
+	for (auto& texture : textures_)
+	{
+		glDeleteTextures(1, &texture.id);
+		texture.id = 0;
+		texture.resident_level = -1;
+		texture.resident_bytes = 0;
+	}
+	resident_bytes_ = 0;
+	reserved_bytes_ = 0;
+	loads_in_flight_ = 0;
+	jobs_pending_ = 0;
+}
+
+int TextureStreamer::addTexture(const std::string & path)
+{
+	Texture texture;
+	texture.path = path;
+	textures_.push_back(texture);
+
+	const int handle = (int)textures_.size() - 1;
+	queueLoad(handle, -1);
+	return handle;
+}
+
+void TextureStreamer::flush()
+{
+	{
+		std::unique_lock<std::mutex> lock(mutex_);
+		done_condition_.wait(lock, [&] { return jobs_pending_ == 0; });
+	}
+
+	for (;;)
+	{
+		LoadResult result;
+		if (!popResult(result))
+			break;
+		applyLoad(result);
+	}
+}
+
+void TextureStreamer::beginFrame()
+{
+	frame_++;
+	for (auto& texture : textures_)
+		texture.requested_level = kNotRequested;
+}
+
+void TextureStreamer::requestLevel(int handle, int level)
+{
+	if (handle == kInvalidHandle)
+		return;
+
+	Texture& texture = textures_[handle];
+	texture.requested_level = std::min(texture.requested_level, std::max(0, level));
+	texture.last_used_frame = frame_;
+}
+
+bool TextureStreamer::update()
+{
+	textures_changed_ = false;
+
+	//upload whatever the workers have finished
+	for (int i = 0; i < kMaxUploadsPerUpdate; i++)
+	{
+		LoadResult result;
+		if (!popResult(result))
+			break;
+		applyLoad(result);
+	}
+
+	//find every texture that was drawn last frame with less detail than
+	//it needed, the ones missing the most mips go first
+	candidates_.clear();
+	for (size_t i = 0; i < textures_.size(); i++)
+	{
+		const Texture& texture = textures_[i];
+		if (texture.resident_level >= 0 && texture.loading_level < 0
+			&& texture.last_used_frame == frame_
+			&& texture.requested_level < texture.resident_level)
+		{
+			candidates_.push_back((int)i);
+		}
+	}
+	std::sort(candidates_.begin(), candidates_.end(), [&](int a, int b) {
+		const Texture& ta = textures_[a];
+		const Texture& tb = textures_[b];
+		return ta.resident_level - ta.requested_level
+			> tb.resident_level - tb.requested_level;
+	});
+
+	for (int handle : candidates_)
+	{
+		if (loads_in_flight_ >= kMaxLoadsInFlight)
+			break;
+
+		//stream the sharpest level that can fit, a request that never could
+		//shouldn't empty the budget and then get nothing
+		Texture& texture = textures_[handle];
+		const std::size_t available = availableBytes();
+		int level = texture.requested_level;
+		while (level < texture.resident_level
+			&& bytesForLevels(texture, level) - texture.resident_bytes > available)
+		{
+			level++;
+		}
+		if (level >= texture.resident_level)
+			continue;
+
+		const std::size_t extra_bytes = bytesForLevels(texture, level) - texture.resident_bytes;
+		if (!makeRoom(extra_bytes))
+			continue;
+
+		reserved_bytes_ += extra_bytes;
+		queueLoad(handle, level);
+	}
+
+	return textures_changed_;
+}
+
+GLuint TextureStreamer::textureId(int handle) const
+{
+	return handle == kInvalidHandle ? 0 : textures_[handle].id;
+}
+
+int TextureStreamer::textureSize(int handle) const
+{
+	if (handle == kInvalidHandle)
+		return 0;
+	return std::max(textures_[handle].width, textures_[handle].height);
+}
+
+TextureStreamer::Stats TextureStreamer::stats() const
+{
+	Stats stats;
+	stats.resident_bytes = resident_bytes_;
+	stats.budget_bytes = budget_bytes_;
+	stats.loads_in_flight = loads_in_flight_;
+	for (const auto& texture : textures_)
+	{
+		if (texture.level_count == 0)
+			continue;
+		const int level = texture.last_used_frame == frame_
+			? std::min(texture.requested_level, texture.tail_level)
+			: texture.tail_level;
+		stats.requested_bytes += bytesForLevels(texture, level);
+	}
+	return stats;
+}
+
+void TextureStreamer::workerLoop()
+{
+	for (;;)
+	{
+		LoadJob job;
+		{
+			std::unique_lock<std::mutex> lock(mutex_);
+			job_condition_.wait(lock, [&] { return !jobs_.empty() || !running_; });
+			if (!running_)
+				return;
+			job = jobs_.front();
+			jobs_.pop_front();
+		}
+
+		LoadResult result;
+		load(job, result);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			if (!running_)
+				return;
+			results_.push_back(std::move(result));
+			jobs_pending_--;
+		}
+		done_condition_.notify_all();
+	}
+}
+
+void TextureStreamer::load(const LoadJob & job, LoadResult & result)
+{
+	result.handle = job.handle;
+	result.first_level = job.first_level;
+	result.width = 0;
+	result.height = 0;
+
+	tygra::Image image = tygra::createImageFromPngFile(job.path);
+	if (!image.doesContainData())
+		return;
+
+	result.width = image.width();
+	result.height = image.height();
+
+	//expand to rgba8 the same way GL would treat the original formats
+	const int components = image.componentsPerPixel();
+	const int component_bytes = image.bytesPerComponent();
+	const int texel_count = result.width * result.height;
+	const unsigned char * pixels = static_cast<const unsigned char *>(image.pixelData());
+
+	std::vector<unsigned char> level(texel_count * kBytesPerTexel);
+	for (int i = 0; i < texel_count; i++)
+	{
+		unsigned char rgba[4] = { 0, 0, 0, 255 };
+		for (int c = 0; c < components && c < 4; c++)
+		{
+			const unsigned char * component = pixels + (i * components + c) * component_bytes;
+			rgba[c] = component_bytes == 1
+				? component[0]
+				: (unsigned char)(*reinterpret_cast<const unsigned short *>(component) >> 8);
+		}
+		std::memcpy(&level[i * kBytesPerTexel], rgba, kBytesPerTexel);
+	}
+
+	int level_count = 1;
+	while ((result.width >> level_count) > 0 || (result.height >> level_count) > 0)
+		level_count++;
+
+	int first_level = job.first_level;
+	if (first_level < 0)
+	{
+		first_level = 0;
+		while (first_level < level_count - 1
+			&& std::max(mipSize(result.width, first_level), mipSize(result.height, first_level)) > kTailSize)
+		{
+			first_level++;
+		}
+	}
+	result.first_level = first_level;
+
+	//box filter down the chain, keeping only the levels that were asked for
+	for (int l = 0; l < level_count; l++)
+	{
+		if (l >= first_level)
+			result.levels.push_back(level);
+
+		if (l + 1 == level_count)
+			break;
+
+		const int src_width = mipSize(result.width, l);
+		const int src_height = mipSize(result.height, l);
+		const int dst_width = mipSize(result.width, l + 1);
+		const int dst_height = mipSize(result.height, l + 1);
+		std::vector<unsigned char> next(dst_width * dst_height * kBytesPerTexel);
+		for (int y = 0; y < dst_height; y++)
+		{
+			const int y0 = std::min(y * 2, src_height - 1);
+			const int y1 = std::min(y * 2 + 1, src_height - 1);
+			for (int x = 0; x < dst_width; x++)
+			{
+				const int x0 = std::min(x * 2, src_width - 1);
+				const int x1 = std::min(x * 2 + 1, src_width - 1);
+				for (int c = 0; c < kBytesPerTexel; c++)
+				{
+					const int sum = level[(y0 * src_width + x0) * kBytesPerTexel + c]
+						+ level[(y0 * src_width + x1) * kBytesPerTexel + c]
+						+ level[(y1 * src_width + x0) * kBytesPerTexel + c]
+						+ level[(y1 * src_width + x1) * kBytesPerTexel + c];
+					next[(y * dst_width + x) * kBytesPerTexel + c] = (unsigned char)((sum + 2) / 4);
+				}
+			}
+		}
+		level.swap(next);
+	}
+}
+
+void TextureStreamer::queueLoad(int handle, int first_level)
+{
+	Texture& texture = textures_[handle];
+	texture.loading_level = first_level;
+	loads_in_flight_++;
+
+	LoadJob job;
+	job.handle = handle;
+	job.path = texture.path;
+	job.first_level = first_level;
+	{
+		std::lock_guard<std::mutex> lock(mutex_);
+		jobs_.push_back(job);
+		jobs_pending_++;
+	}
+	job_condition_.notify_one();
+}
+
+bool TextureStreamer::popResult(LoadResult & result)
+{
+	//results are moved out so the upload doesn't hold up the workers
+	std::lock_guard<std::mutex> lock(mutex_);
+	if (results_.empty())
+		return false;
+	result = std::move(results_.front());
+	results_.pop_front();
+	return true;
+}
+
+void TextureStreamer::applyLoad(LoadResult & result)
+{
+	Texture& texture = textures_[result.handle];
+	loads_in_flight_--;
+
+	if (texture.loading_level >= 0)
+	{
+		const std::size_t expected = bytesForLevels(texture, texture.loading_level);
+		reserved_bytes_ -= expected - std::min(expected, texture.resident_bytes);
+	}
+	texture.loading_level = -1;
+
+	if (result.levels.empty())
+	{
+		std::cerr << "Failed to load texture " << texture.path << std::endl;
+		return;
+	}
+
+	if (texture.level_count == 0)
+	{
+		texture.width = result.width;
+		texture.height = result.height;
+		texture.level_count = result.first_level + (int)result.levels.size();
+		texture.tail_level = result.first_level;
+	}
+
+	if (texture.tail.empty())
+	{
+		const int skip = texture.tail_level - result.first_level;
+		texture.tail.assign(result.levels.begin() + skip, result.levels.end());
+	}
+
+	upload(texture, result.first_level, result.levels);
+}
+
+void TextureStreamer::upload(Texture & texture, int first_level, const MipChain & levels)
+{
+	GLuint id = 0;
+	glGenTextures(1, &id);
+	glBindTexture(GL_TEXTURE_2D, id);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+		GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+	for (size_t i = 0; i < levels.size(); i++)
+	{
+		const int level = first_level + (int)i;
+		glTexImage2D(GL_TEXTURE_2D,
+			(GLint)i,
+			GL_RGBA,
+			mipSize(texture.width, level),
+			mipSize(texture.height, level),
+			0,
+			GL_RGBA,
+			GL_UNSIGNED_BYTE,
+			levels[i].data());
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	glDeleteTextures(1, &texture.id);
+	texture.id = id;
+
+	resident_bytes_ -= texture.resident_bytes;
+	texture.resident_level = first_level;
+	texture.resident_bytes = bytesForLevels(texture, first_level);
+	resident_bytes_ += texture.resident_bytes;
+
+	textures_changed_ = true;
+}
+
+bool TextureStreamer::isEvictable(const Texture & texture) const
+{
+	return texture.last_used_frame != frame_ && texture.loading_level < 0
+		&& texture.resident_level >= 0
+		&& texture.resident_level < texture.tail_level;
+}
+
+std::size_t TextureStreamer::availableBytes() const
+{
+	//what is free now plus what evicting every unused texture would free
+	std::size_t bytes = budget_bytes_ - std::min(budget_bytes_, resident_bytes_ + reserved_bytes_);
+	for (const auto& texture : textures_)
+	{
+		if (isEvictable(texture))
+			bytes += texture.resident_bytes - bytesForLevels(texture, texture.tail_level);
+	}
+	return bytes;
+}
+
+bool TextureStreamer::makeRoom(std::size_t bytes)
+{
+	//don't evict anything for a request that can't fit anyway
+	if (bytes > availableBytes())
+		return false;
+
+	while (resident_bytes_ + reserved_bytes_ + bytes > budget_bytes_)
+	{
+		//evict whichever texture has gone unused the longest
+		Texture * oldest = nullptr;
+		for (auto& texture : textures_)
+		{
+			if (!isEvictable(texture))
+				continue;
+			if (oldest == nullptr || texture.last_used_frame < oldest->last_used_frame)
+				oldest = &texture;
+		}
+
+		if (oldest == nullptr)
+			return false;
+
+		upload(*oldest, oldest->tail_level, oldest->tail);
+	}
+	return true;
+}
+
+std::size_t TextureStreamer::bytesForLevels(const Texture & texture, int first_level) const
+{
+	std::size_t bytes = 0;
+	for (int level = first_level; level < texture.level_count; level++)
+	{
+		bytes += (std::size_t)mipSize(texture.width, level)
+			* mipSize(texture.height, level) * kBytesPerTexel;
+	}
+	return bytes;
+}
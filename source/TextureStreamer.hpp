@@ -0,0 +1,157 @@
+#pragma once
+
+#include <tgl/tgl.h>
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Keeps textures within a memory budget by only holding the mips that are
+// actually needed on the GPU.
+// Every texture starts with just its small tail mips resident. Each frame the
+// view tells the streamer which mip it needs for every texture it draws and
+// update() decodes the sharper mips on worker threads and uploads them,
+// evicting the least recently used textures back to their tail if the
+// budget would be exceeded.
+// Apart from the workers everything must be called from the GL thread.
+class TextureStreamer
+{
+public:
+
+	struct Stats
+	{
+		std::size_t resident_bytes{ 0 };
+		std::size_t requested_bytes{ 0 };
+		std::size_t budget_bytes{ 0 };
+		int loads_in_flight{ 0 };
+	};
+
+	static const int kInvalidHandle = -1;
+
+	// Mips no bigger than this are always resident
+	static const int kTailSize = 64;
+
+	explicit TextureStreamer(std::size_t budget_bytes);
+
+	~TextureStreamer();
+
+	void start();
+
+	void stop();
+
+	// Queues the tail mips of a png to be loaded, they will be resident
+	// after the next call to flush()
+	int addTexture(const std::string & path);
+
+	// Blocks until every queued load has finished and uploads them
+	void flush();
+
+	void setBudget(std::size_t budget_bytes) { budget_bytes_ = budget_bytes; }
+
+	// Call once per drawn frame before requesting any levels
+	void beginFrame();
+
+	// Asks for a texture to have the given mip level (0 is full size) or
+	// sharper resident, the sharpest request within a frame wins
+	void requestLevel(int handle, int level);
+
+	// Uploads finished loads and starts new ones based on last frame's
+	// requests. Returns true if any texture changed
+	bool update();
+
+	GLuint textureId(int handle) const;
+
+	// Size of the biggest side of mip 0, zero if the texture failed to load
+	int textureSize(int handle) const;
+
+	Stats stats() const;
+
+private:
+
+	typedef std::vector<std::vector<unsigned char>> MipChain;
+
+	struct Texture
+	{
+		std::string path;
+		GLuint id{ 0 };
+		int width{ 0 };
+		int height{ 0 };
+		int level_count{ 0 };
+		int tail_level{ 0 };
+
+		int resident_level{ -1 };
+		std::size_t resident_bytes{ 0 };
+		int loading_level{ -1 };
+		int requested_level{ 0 };
+		std::uint64_t last_used_frame{ 0 };
+
+		// CPU copy of the tail so evicting doesn't need to touch the disk
+		MipChain tail;
+	};
+
+	struct LoadJob
+	{
+		int handle;
+		std::string path;
+		int first_level; // -1 to load just the tail
+	};
+
+	struct LoadResult
+	{
+		int handle;
+		int first_level;
+		int width;
+		int height;
+		MipChain levels;
+	};
+
+	void workerLoop();
+
+	static void load(const LoadJob & job, LoadResult & result);
+
+	void queueLoad(int handle, int first_level);
+
+	bool popResult(LoadResult & result);
+
+	void applyLoad(LoadResult & result);
+
+	void upload(Texture & texture, int first_level, const MipChain & levels);
+
+	bool isEvictable(const Texture & texture) const;
+
+	// Bytes a load could use, counting what evicting unused textures frees
+	std::size_t availableBytes() const;
+
+	// Evicts unused textures until bytes fit, false without evicting
+	// anything if they never can
+	bool makeRoom(std::size_t bytes);
+
+	std::size_t bytesForLevels(const Texture & texture, int first_level) const;
+
+private:
+
+	std::size_t budget_bytes_{ 0 };
+	std::size_t resident_bytes_{ 0 };
+	std::size_t reserved_bytes_{ 0 };
+	std::uint64_t frame_{ 1 };
+	bool textures_changed_{ false };
+
+	std::vector<Texture> textures_;
+	std::vector<int> candidates_;
+
+	std::vector<std::thread> workers_;
+	bool running_{ false };
+	int loads_in_flight_{ 0 };
+
+	mutable std::mutex mutex_;
+	std::condition_variable job_condition_;
+	std::condition_variable done_condition_;
+	std::deque<LoadJob> jobs_;
+	std::deque<LoadResult> results_;
+	int jobs_pending_{ 0 };
+};
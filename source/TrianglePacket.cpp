@@ -0,0 +1,85 @@
+#include "TrianglePacket.hpp"
+
+#ifdef TRIANGLE_PACKET_SSE
+#include <xmmintrin.h>
+#endif
+
+// Rays this close to parallel with a triangle don't hit it
+static const float kDeterminantEpsilon = 1e-8f;
+
+// Moller-Trumbore against each lane in turn
+bool intersectPacketScalar(const TrianglePacket & packet, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance)
+{
+	for (int lane = 0; lane < 4; lane++)
+	{
+		const glm::vec3 v0(packet.v0[0][lane], packet.v0[1][lane], packet.v0[2][lane]);
+		const glm::vec3 edge1(packet.edge1[0][lane], packet.edge1[1][lane], packet.edge1[2][lane]);
+		const glm::vec3 edge2(packet.edge2[0][lane], packet.edge2[1][lane], packet.edge2[2][lane]);
+		const glm::vec3 p = glm::cross(direction, edge2);
+		const float det = glm::dot(edge1, p);
+		if (glm::abs(det) <= kDeterminantEpsilon)
+			continue;
+		const float inverse_det = 1.f / det;
+		const glm::vec3 to_origin = origin - v0;
+		const float u = glm::dot(to_origin, p) * inverse_det;
+		if (u < 0.f)
+			continue;
+		const glm::vec3 q = glm::cross(to_origin, edge1);
+		const float v = glm::dot(direction, q) * inverse_det;
+		if (v < 0.f || u + v > 1.f)
+			continue;
+		const float t = glm::dot(edge2, q) * inverse_det;
+		if (t > 0.f && t < max_distance)
+			return true;
+	}
+	return false;
+}
+
+#ifdef TRIANGLE_PACKET_SSE
+// Moller-Trumbore against four triangles at once
+bool intersectPacketSse(const TrianglePacket & packet, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance)
+{
+	const __m128 dx = _mm_set1_ps(direction.x);
+	const __m128 dy = _mm_set1_ps(direction.y);
+	const __m128 dz = _mm_set1_ps(direction.z);
+
+	const __m128 e1x = _mm_loadu_ps(packet.edge1[0]);
+	const __m128 e1y = _mm_loadu_ps(packet.edge1[1]);
+	const __m128 e1z = _mm_loadu_ps(packet.edge1[2]);
+	const __m128 e2x = _mm_loadu_ps(packet.edge2[0]);
+	const __m128 e2y = _mm_loadu_ps(packet.edge2[1]);
+	const __m128 e2z = _mm_loadu_ps(packet.edge2[2]);
+
+	//p = d x e2, det = e1 . p
+	const __m128 px = _mm_sub_ps(_mm_mul_ps(dy, e2z), _mm_mul_ps(dz, e2y));
+	const __m128 py = _mm_sub_ps(_mm_mul_ps(dz, e2x), _mm_mul_ps(dx, e2z));
+	const __m128 pz = _mm_sub_ps(_mm_mul_ps(dx, e2y), _mm_mul_ps(dy, e2x));
+	const __m128 det = _mm_add_ps(_mm_add_ps(_mm_mul_ps(e1x, px), _mm_mul_ps(e1y, py)), _mm_mul_ps(e1z, pz));
+	const __m128 abs_det = _mm_andnot_ps(_mm_set1_ps(-0.f), det);
+	__m128 mask = _mm_cmpgt_ps(abs_det, _mm_set1_ps(kDeterminantEpsilon));
+	const __m128 inverse_det = _mm_div_ps(_mm_set1_ps(1.f), det);
+
+	//t = o - v0, u = (t . p) / det
+	const __m128 tx = _mm_sub_ps(_mm_set1_ps(origin.x), _mm_loadu_ps(packet.v0[0]));
+	const __m128 ty = _mm_sub_ps(_mm_set1_ps(origin.y), _mm_loadu_ps(packet.v0[1]));
+	const __m128 tz = _mm_sub_ps(_mm_set1_ps(origin.z), _mm_loadu_ps(packet.v0[2]));
+	const __m128 u = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(tx, px), _mm_mul_ps(ty, py)), _mm_mul_ps(tz, pz)), inverse_det);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(u, _mm_setzero_ps()));
+
+	//q = t x e1, v = (d . q) / det, distance = (e2 . q) / det
+	const __m128 qx = _mm_sub_ps(_mm_mul_ps(ty, e1z), _mm_mul_ps(tz, e1y));
+	const __m128 qy = _mm_sub_ps(_mm_mul_ps(tz, e1x), _mm_mul_ps(tx, e1z));
+	const __m128 qz = _mm_sub_ps(_mm_mul_ps(tx, e1y), _mm_mul_ps(ty, e1x));
+	const __m128 v = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, qx), _mm_mul_ps(dy, qy)), _mm_mul_ps(dz, qz)), inverse_det);
+	mask = _mm_and_ps(mask, _mm_cmpge_ps(v, _mm_setzero_ps()));
+	mask = _mm_and_ps(mask, _mm_cmple_ps(_mm_add_ps(u, v), _mm_set1_ps(1.f)));
+
+	const __m128 t = _mm_mul_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(e2x, qx), _mm_mul_ps(e2y, qy)), _mm_mul_ps(e2z, qz)), inverse_det);
+	mask = _mm_and_ps(mask, _mm_cmpgt_ps(t, _mm_setzero_ps()));
+	mask = _mm_and_ps(mask, _mm_cmplt_ps(t, _mm_set1_ps(max_distance)));
+
+	return _mm_movemask_ps(mask) != 0;
+}
+#endif
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__SSE__)
+#define TRIANGLE_PACKET_SSE 1
+#endif
+
+// Four triangles laid out for SSE, unused lanes are degenerate
+struct TrianglePacket
+{
+	float v0[3][4];
+	float edge1[3][4];
+	float edge2[3][4];
+};
+
+// Whether the ray hits any of the four triangles strictly between zero and
+// max_distance. Both versions are always there so they can be checked
+// against each other, intersectPacket picks the fast one.
+bool intersectPacketScalar(const TrianglePacket & packet, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance);
+
+#ifdef TRIANGLE_PACKET_SSE
+bool intersectPacketSse(const TrianglePacket & packet, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance);
+#endif
+
+inline bool intersectPacket(const TrianglePacket & packet, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance)
+{
+#ifdef TRIANGLE_PACKET_SSE
+	return intersectPacketSse(packet, origin, direction, max_distance);
+#else
+	return intersectPacketScalar(packet, origin, direction, max_distance);
+#endif
+}
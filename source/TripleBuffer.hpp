@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+
+// Single producer / single consumer triple buffer.
+// The writer fills back() and calls publish() which swaps it with the middle
+// slot. The reader calls acquire() to swap the newest published slot into
+// front(). Neither side ever waits on the other.
+template<typename T>
+class TripleBuffer
+{
+public:
+
+	TripleBuffer() {}
+
+	TripleBuffer(const TripleBuffer &) = delete;
+	TripleBuffer & operator=(const TripleBuffer &) = delete;
+
+	// Writer side
+	T & back() { return buffers_[back_]; }
+
+	void publish()
+	{
+		const unsigned int old = state_.exchange(back_ | kFreshBit,
+			std::memory_order_acq_rel);
+		back_ = old & kIndexMask;
+	}
+
+	// Reader side, returns true if front() now holds newer data
+	bool acquire()
+	{
+		if ((state_.load(std::memory_order_acquire) & kFreshBit) == 0)
+			return false;
+		const unsigned int old = state_.exchange(front_,
+			std::memory_order_acq_rel);
+		front_ = old & kIndexMask;
+		return true;
+	}
+
+	const T & front() const { return buffers_[front_]; }
+
+private:
+
+	static const unsigned int kIndexMask = 0x3;
+	static const unsigned int kFreshBit = 0x4;
+
+	T buffers_[3];
+
+	//index of the middle slot plus a flag telling if it has not been read yet
+	std::atomic<unsigned int> state_{ 1 };
+
+	unsigned int back_{ 0 };
+	unsigned int front_{ 2 };
+};
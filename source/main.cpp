@@ -25,6 +25,7 @@ int main(int argc, char *argv[])
             number_of_samples, true)) {
             while (window->isVisible()) {
                 window->update();
+                controller->waitForNextFrame();
             }
             window->close();
         }
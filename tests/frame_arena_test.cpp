@@ -0,0 +1,164 @@
+// Checks that building a frame's draw list with buildDrawList, the code
+// MyView::drawInstances uses, stops touching the heap once the frame arena
+// has warmed up, and that an arena which keeps spilling would be caught.
+
+#include "AllocationTracker.hpp"
+#include "DrawList.hpp"
+#include "FrameArena.hpp"
+#include "Frustum.hpp"
+
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+#ifndef SPONZA_TRACK_ALLOCATIONS
+#error "frame_arena_test must be built with allocation tracking"
+#endif
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			failures++; \
+		} \
+	} while (false)
+
+struct Vec3 { float x, y, z; };
+struct Vec4 { float x, y, z, w; };
+
+struct TestInstance
+{
+	Vec3 centre;
+	float radius;
+	int mesh_index;
+	int material_index;
+};
+
+static const int kWarmupFrames = 60;
+static const int kFrames = 300;
+static const int kMaxInstances = 400;
+
+// Culls a varying number of instances against a frustum that moves every
+// frame, returns a checksum so nothing can be optimised away
+static std::uint64_t buildFrame(FrameArena & arena, const std::vector<TestInstance> & instances,
+	std::vector<int> & persistent, int frame)
+{
+	arena.reset();
+
+	// the instance count changes every frame but never goes over the max
+	const std::size_t instance_count = kMaxInstances - (frame * 37) % (kMaxInstances / 2);
+
+	// an axis aligned box around the origin, sliding along x
+	const float offset = (float)(frame % 50) - 25.f;
+	const Vec4 planes[6] = {
+		{ 1, 0, 0, 60 - offset }, { -1, 0, 0, 60 + offset },
+		{ 0, 1, 0, 60 }, { 0, -1, 0, 60 },
+		{ 0, 0, 1, 60 }, { 0, 0, -1, 60 } };
+
+	DrawList draw_list{ FrameAllocator<DrawItem>(arena) };
+	buildDrawList(draw_list, instance_count, [&](DrawItem& item)
+	{
+		const TestInstance& instance = instances[item.instance_index];
+		if (!isInsideFrustum(planes, instance.centre, instance.radius))
+			return false;
+		item.mesh_index = instance.mesh_index;
+		item.material_index = instance.material_index;
+		return true;
+	});
+
+	// scratch that isn't sized up front, it has to grow inside the arena
+	FrameVector<int> meshes{ FrameAllocator<int>(arena) };
+	for (const auto& item : draw_list)
+	{
+		if (meshes.empty() || meshes.back() != item.mesh_index)
+			meshes.push_back(item.mesh_index);
+	}
+
+	// containers that outlive the frame keep their capacity
+	persistent.assign(instance_count / 4, frame);
+
+	std::uint64_t checksum = 0;
+	for (size_t i = 0; i < draw_list.size(); i++)
+	{
+		if (i > 0)
+			CHECK(draw_list[i - 1].sort_key <= draw_list[i].sort_key);
+		checksum = checksum * 31 + draw_list[i].sort_key;
+	}
+	return checksum + meshes.size() + persistent.size();
+}
+
+int main()
+{
+	CHECK(AllocationTracker::isEnabled());
+
+	// make sure the counter really sees operator new, otherwise the steady
+	// state check below would pass for the wrong reason
+	const std::uint64_t before_new = AllocationTracker::threadAllocationCount();
+	int * probe = new int(1);
+	CHECK(AllocationTracker::threadAllocationCount() == before_new + 1);
+	delete probe;
+
+	// and that an arena going over its capacity shows up in the count
+	{
+		FrameArena small_arena(64);
+		const std::uint64_t before_spill = AllocationTracker::threadAllocationCount();
+		small_arena.allocate(1024, 16);
+		CHECK(AllocationTracker::threadAllocationCount() > before_spill);
+		CHECK(small_arena.heapAllocations() == 2);
+	}
+
+	std::vector<TestInstance> instances(kMaxInstances);
+	for (int i = 0; i < kMaxInstances; i++)
+	{
+		TestInstance& instance = instances[i];
+		instance.centre = { (float)((i * 7919) % 200) - 100.f, (float)((i * 104729) % 100) - 50.f,
+			(float)((i * 1299709) % 160) - 80.f };
+		instance.radius = 1.f + (float)(i % 7);
+		instance.mesh_index = (i * 7919) % 61;
+		instance.material_index = i % 13;
+	}
+
+	// deliberately smaller than one frame needs so it has to grow
+	FrameArena arena(256);
+	std::vector<int> persistent;
+	std::uint64_t checksum = 0;
+
+	const std::uint64_t at_start = AllocationTracker::threadAllocationCount();
+	std::uint64_t after_warmup = 0;
+	std::uint64_t arena_after_warmup = 0;
+	int allocating_frames = 0;
+	for (int frame = 0; frame < kFrames; frame++)
+	{
+		const std::uint64_t before = AllocationTracker::threadAllocationCount();
+		if (frame == kWarmupFrames)
+		{
+			after_warmup = before;
+			arena_after_warmup = arena.heapAllocations();
+		}
+
+		checksum += buildFrame(arena, instances, persistent, frame);
+		const std::uint64_t allocations = AllocationTracker::threadAllocationCount() - before;
+
+		if (frame >= kWarmupFrames && allocations > 0)
+		{
+			if (allocating_frames++ == 0)
+				std::cerr << "frame " << frame << " made " << allocations << " allocations" << std::endl;
+		}
+	}
+	const std::uint64_t at_end = AllocationTracker::threadAllocationCount();
+
+	// warming up is allowed to allocate, that is how the arena finds its size
+	CHECK(after_warmup > at_start);
+	CHECK(arena.capacity() > 256);
+	CHECK(allocating_frames == 0);
+	CHECK(at_end == after_warmup);
+	CHECK(arena.heapAllocations() == arena_after_warmup);
+
+	std::cout << "arena capacity " << arena.capacity() << " bytes, "
+		<< (after_warmup - at_start) << " allocations while warming up, "
+		<< (at_end - after_warmup) << " after (checksum " << checksum << ")" << std::endl;
+
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,903 @@
+// Dispatches cull_cs.glsl on a headless GL context (llvmpipe works) and
+// checks the draw counts and commands it writes against the CPU frustum
+// test in Frustum.hpp. Then builds a depth pyramid with depth_pyramid_cs.glsl
+// from a known depth image whose size isn't a power of two, checks occlusion
+// culling never drops an instance that can be seen, and draws the result with
+// both the indirect count path and the zeroed slot fallback.
+// Exits with kSkipped when no GL 4.3 context exists.
+
+#define GL_GLEXT_PROTOTYPES
+#include <GL/glcorearb.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include "Frustum.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+static const int kSkipped = 77;
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			failures++; \
+		} \
+	} while (false)
+
+struct Vec3 { float x, y, z; };
+struct Vec4 { float x, y, z, w; };
+
+// These mirror the std430 structs in cull_cs.glsl and GpuDrivenRenderer.hpp
+struct GpuInstance
+{
+	float model[16];
+	float bounds[4];
+	std::uint32_t mesh_index;
+	std::uint32_t material_index;
+	std::uint32_t command_offset;
+	float uv_density;
+	std::uint32_t baked_offset;
+	std::uint32_t pad[3];
+};
+static_assert(sizeof(GpuInstance) == 112, "GpuInstance must match the std430 layout");
+
+struct GpuMesh
+{
+	std::uint32_t first_index;
+	std::uint32_t index_count;
+	std::int32_t base_vertex;
+	std::uint32_t pad;
+};
+
+struct DrawCommand
+{
+	std::uint32_t count;
+	std::uint32_t instance_count;
+	std::uint32_t first_index;
+	std::int32_t base_vertex;
+	std::uint32_t base_instance;
+};
+
+static const int kMeshCount = 5;
+static const int kMaterialCount = 7;
+static const int kInstanceCount = 5000;
+static const std::uint32_t kNoDemand = 0xFFFFFFFFu;
+
+// Odd in both directions so every level of the pyramid folds a remainder
+static const int kDepthWidth = 333;
+static const int kDepthHeight = 187;
+static const int kPyramidGroupSize = 8;
+
+// One pixel per instance when checking what the draws reach
+static const int kTargetWidth = 100;
+static const int kTargetHeight = 50;
+static_assert(kTargetWidth * kTargetHeight >= kInstanceCount, "every instance needs a pixel");
+
+struct CullBuffers
+{
+	GLuint instances;
+	GLuint meshes;
+	GLuint commands;
+	GLuint counts;
+	GLuint demand;
+};
+
+struct Occlusion
+{
+	bool enabled;
+	const float * view_projection;
+	GLuint pyramid;
+	int levels;
+};
+
+// Column major like glm, out = a * b
+static void multiply(const float * a, const float * b, float * out)
+{
+	for (int column = 0; column < 4; column++)
+	{
+		for (int row = 0; row < 4; row++)
+		{
+			float sum = 0.f;
+			for (int k = 0; k < 4; k++)
+				sum += a[k * 4 + row] * b[column * 4 + k];
+			out[column * 4 + row] = sum;
+		}
+	}
+}
+
+// Same view as glm::perspective * glm::lookAt with a camera at eye looking
+// down -z, rotated about y by yaw
+static void viewProjection(const Vec3 & eye, float yaw, float * out)
+{
+	const float fov = 60.f * 3.14159265f / 180.f;
+	const float aspect = 16.f / 9.f;
+	const float near_plane = 1.f;
+	const float far_plane = 400.f;
+	const float f = 1.f / std::tan(fov * 0.5f);
+
+	float projection[16] = {};
+	projection[0] = f / aspect;
+	projection[5] = f;
+	projection[10] = -(far_plane + near_plane) / (far_plane - near_plane);
+	projection[11] = -1.f;
+	projection[14] = -2.f * far_plane * near_plane / (far_plane - near_plane);
+
+	const float c = std::cos(yaw);
+	const float s = std::sin(yaw);
+	float view[16] = {
+		c, 0, s, 0,
+		0, 1, 0, 0,
+		-s, 0, c, 0,
+		0, 0, 0, 1 };
+	view[12] = -(c * eye.x - s * eye.z);
+	view[13] = -eye.y;
+	view[14] = -(s * eye.x + c * eye.z);
+
+	multiply(projection, view, out);
+}
+
+// The planes MyView extracts from its view projection, pointing inwards
+static void frustumPlanes(const float * view_projection, Vec4 (&planes)[6])
+{
+	float rows[4][4];
+	for (int row = 0; row < 4; row++)
+	{
+		for (int column = 0; column < 4; column++)
+			rows[row][column] = view_projection[column * 4 + row];
+	}
+	for (int i = 0; i < 3; i++)
+	{
+		for (int side = 0; side < 2; side++)
+		{
+			const float sign = side == 0 ? 1.f : -1.f;
+			Vec4& plane = planes[i * 2 + side];
+			plane.x = rows[3][0] + sign * rows[i][0];
+			plane.y = rows[3][1] + sign * rows[i][1];
+			plane.z = rows[3][2] + sign * rows[i][2];
+			plane.w = rows[3][3] + sign * rows[i][3];
+		}
+	}
+	for (auto& plane : planes)
+	{
+		const float length = std::sqrt(plane.x * plane.x + plane.y * plane.y + plane.z * plane.z);
+		plane.x /= length;
+		plane.y /= length;
+		plane.z /= length;
+		plane.w /= length;
+	}
+}
+
+static bool createContext()
+{
+	auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (get_platform_display == nullptr)
+		return false;
+	EGLDisplay display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, nullptr);
+	if (display == EGL_NO_DISPLAY || !eglInitialize(display, nullptr, nullptr))
+		return false;
+	if (!eglBindAPI(EGL_OPENGL_API))
+		return false;
+
+	const EGLint context_attributes[] = {
+		EGL_CONTEXT_MAJOR_VERSION, 4,
+		EGL_CONTEXT_MINOR_VERSION, 3,
+		EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+		EGL_NONE };
+	EGLContext context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, context_attributes);
+	if (context == EGL_NO_CONTEXT)
+		return false;
+	return eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context) == EGL_TRUE;
+}
+
+static std::string loadShader(const char * file_name)
+{
+	std::ifstream file(std::string(SPONZA_SHADER_DIR "/") + file_name);
+	std::stringstream stream;
+	stream << file.rdbuf();
+	if (stream.str().empty())
+		std::cerr << "Can't read " SPONZA_SHADER_DIR "/" << file_name << std::endl;
+	return stream.str();
+}
+
+static GLuint compileShader(GLenum stage, const char * name, const std::string & shader_string)
+{
+	if (shader_string.empty())
+		return 0;
+
+	GLint status = GL_FALSE;
+	GLuint shader = glCreateShader(stage);
+	const char * shader_code = shader_string.c_str();
+	glShaderSource(shader, 1, &shader_code, nullptr);
+	glCompileShader(shader);
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		GLchar log[1024] = "";
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		std::cerr << name << ": " << log << std::endl;
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+static GLuint linkProgram(const char * name, std::initializer_list<GLuint> shaders)
+{
+	GLuint program = glCreateProgram();
+	bool compiled = true;
+	for (GLuint shader : shaders)
+	{
+		compiled = compiled && shader != 0;
+		if (shader != 0)
+		{
+			glAttachShader(program, shader);
+			glDeleteShader(shader);
+		}
+	}
+	if (!compiled)
+	{
+		glDeleteProgram(program);
+		return 0;
+	}
+
+	GLint status = GL_FALSE;
+	glLinkProgram(program);
+	glGetProgramiv(program, GL_LINK_STATUS, &status);
+	if (status != GL_TRUE)
+	{
+		GLchar log[1024] = "";
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		std::cerr << name << ": " << log << std::endl;
+		glDeleteProgram(program);
+		return 0;
+	}
+	return program;
+}
+
+static GLuint createComputeProgram(const char * file_name)
+{
+	return linkProgram(file_name, { compileShader(GL_COMPUTE_SHADER, file_name, loadShader(file_name)) });
+}
+
+static bool hasExtension(const char * name)
+{
+	GLint count = 0;
+	glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+	for (GLint i = 0; i < count; i++)
+	{
+		if (std::strcmp((const char *)glGetStringi(GL_EXTENSIONS, i), name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static GLuint createBuffer(const void * data, size_t size)
+{
+	GLuint buffer = 0;
+	glGenBuffers(1, &buffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, size, data, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	return buffer;
+}
+
+template <typename T>
+static void readBuffer(GLuint buffer, std::vector<T> & out)
+{
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffer);
+	glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, out.size() * sizeof(T), out.data());
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+}
+
+// World bounds the way MyView::worldBounds and the shader work them out
+static void worldBounds(const GpuInstance & instance, Vec3 & centre, float & radius)
+{
+	const float * m = instance.model;
+	const float * b = instance.bounds;
+	centre.x = m[0] * b[0] + m[4] * b[1] + m[8] * b[2] + m[12];
+	centre.y = m[1] * b[0] + m[5] * b[1] + m[9] * b[2] + m[13];
+	centre.z = m[2] * b[0] + m[6] * b[1] + m[10] * b[2] + m[14];
+	float scale = 0.f;
+	for (int column = 0; column < 3; column++)
+	{
+		const float * axis = m + column * 4;
+		scale = std::max(scale, std::sqrt(axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2]));
+	}
+	radius = b[3] * scale;
+}
+
+// The same clears, uniforms and bindings as GpuDrivenRenderer::cull
+static void runCull(GLuint program, const CullBuffers & buffers, const Vec4 (&planes)[6],
+	const Vec3 & eye, const Occlusion & occlusion)
+{
+	const std::uint32_t zero = 0;
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.counts);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.commands);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &zero);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers.demand);
+	glClearBufferData(GL_SHADER_STORAGE_BUFFER, GL_R32UI, GL_RED_INTEGER, GL_UNSIGNED_INT, &kNoDemand);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	glUseProgram(program);
+	glUniform1ui(glGetUniformLocation(program, "instance_count"), kInstanceCount);
+	glUniform1ui(glGetUniformLocation(program, "material_count"), kMaterialCount);
+	glUniform4fv(glGetUniformLocation(program, "frustum_planes"), 6, &planes[0].x);
+	glUniform3fv(glGetUniformLocation(program, "camera_position"), 1, &eye.x);
+	glUniform1f(glGetUniformLocation(program, "near_plane"), 1.f);
+	glUniform1f(glGetUniformLocation(program, "pixels_per_unit"), 600.f);
+	glUniform1i(glGetUniformLocation(program, "occlusion_enabled"), occlusion.enabled);
+	if (occlusion.enabled)
+	{
+		glUniformMatrix4fv(glGetUniformLocation(program, "pyramid_view_projection"), 1, GL_FALSE,
+			occlusion.view_projection);
+		glUniform1i(glGetUniformLocation(program, "pyramid_levels"), occlusion.levels);
+	}
+	glUniform1i(glGetUniformLocation(program, "depth_pyramid"), 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, occlusion.pyramid);
+
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, buffers.instances);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, buffers.meshes);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, buffers.commands);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, buffers.counts);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 4, buffers.demand);
+	glDispatchCompute((kInstanceCount + 63) / 64, 1, 1);
+	glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	CHECK(glGetError() == GL_NO_ERROR);
+}
+
+// The instances the commands within each material's count draw
+static std::vector<bool> commandedInstances(const CullBuffers & buffers,
+	const std::uint32_t (&material_offsets)[kMaterialCount])
+{
+	std::vector<std::uint32_t> counts(kMaterialCount + 1);
+	std::vector<DrawCommand> commands(kInstanceCount);
+	readBuffer(buffers.counts, counts);
+	readBuffer(buffers.commands, commands);
+
+	std::vector<bool> drawn(kInstanceCount, false);
+	for (int material = 0; material < kMaterialCount; material++)
+	{
+		for (std::uint32_t slot = 0; slot < counts[material]; slot++)
+		{
+			const std::uint32_t instance = commands[material_offsets[material] + slot].base_instance;
+			if (instance < (std::uint32_t)kInstanceCount)
+				drawn[instance] = true;
+		}
+	}
+	return drawn;
+}
+
+// Where a point lands in the depth image, row zero is the bottom like GL
+static bool project(const float * view_projection, const Vec3 & point, Vec3 & ndc)
+{
+	const float * m = view_projection;
+	const float w = m[3] * point.x + m[7] * point.y + m[11] * point.z + m[15];
+	if (w <= 0.f)
+		return false;
+	ndc.x = (m[0] * point.x + m[4] * point.y + m[8] * point.z + m[12]) / w;
+	ndc.y = (m[1] * point.x + m[5] * point.y + m[9] * point.z + m[13]) / w;
+	ndc.z = (m[2] * point.x + m[6] * point.y + m[10] * point.z + m[14]) / w;
+	return true;
+}
+
+// A wall part way into the scene with holes in it, one of them the middle
+// band of rows that lands in the second texel of the coarse levels while
+// its uv is still under a half, and one in the corner the odd rows and
+// columns get folded into
+static std::vector<float> makeDepthImage(const float * view_projection)
+{
+	Vec3 wall_point = { 0.f, 0.f, -60.f };
+	Vec3 wall_ndc;
+	project(view_projection, wall_point, wall_ndc);
+	const float wall_depth = wall_ndc.z * 0.5f + 0.5f;
+
+	std::vector<float> depth(kDepthWidth * kDepthHeight, wall_depth);
+	auto cut = [&](int x0, int y0, int x1, int y1)
+	{
+		for (int y = std::max(0, y0); y < std::min(kDepthHeight, y1); y++)
+		{
+			for (int x = std::max(0, x0); x < std::min(kDepthWidth, x1); x++)
+				depth[y * kDepthWidth + x] = 1.f;
+		}
+	};
+	cut(kDepthWidth * 3 / 10, kDepthHeight * 9 / 20, kDepthWidth * 11 / 20, kDepthHeight * 31 / 50);
+	cut(kDepthWidth - 20, kDepthHeight - 15, kDepthWidth, kDepthHeight);
+
+	std::mt19937 random(99);
+	for (int i = 0; i < 12; i++)
+	{
+		const int x = random() % kDepthWidth;
+		const int y = random() % kDepthHeight;
+		cut(x, y, x + 4 + random() % 40, y + 4 + random() % 30);
+	}
+	return depth;
+}
+
+// Same storage and dispatches as GpuDrivenRenderer::resize and
+// buildDepthPyramid, the levels are checked against the same reduction on
+// the CPU so the cull below can trust them
+static GLuint buildPyramid(const std::vector<float> & depth, int & levels)
+{
+	GLuint depth_texture = 0;
+	glGenTextures(1, &depth_texture);
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT32F, kDepthWidth, kDepthHeight, 0,
+		GL_DEPTH_COMPONENT, GL_FLOAT, depth.data());
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+
+	levels = 1;
+	while ((kDepthWidth >> levels) > 0 || (kDepthHeight >> levels) > 0)
+		levels++;
+
+	GLuint pyramid = 0;
+	glGenTextures(1, &pyramid);
+	glBindTexture(GL_TEXTURE_2D, pyramid);
+	glTexStorage2D(GL_TEXTURE_2D, levels, GL_R32F, kDepthWidth, kDepthHeight);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+
+	const GLuint program = createComputeProgram("depth_pyramid_cs.glsl");
+	CHECK(program != 0);
+	if (program == 0)
+		return 0;
+
+	glUseProgram(program);
+	glUniform1i(glGetUniformLocation(program, "depth_sampler"), 0);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, depth_texture);
+	for (int level = 0; level < levels; level++)
+	{
+		const int width = std::max(1, kDepthWidth >> level);
+		const int height = std::max(1, kDepthHeight >> level);
+
+		glUniform1i(glGetUniformLocation(program, "copy_depth"), level == 0);
+		glBindImageTexture(0, pyramid, std::max(0, level - 1), GL_FALSE, 0, GL_READ_ONLY, GL_R32F);
+		glBindImageTexture(1, pyramid, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+		glDispatchCompute((width + kPyramidGroupSize - 1) / kPyramidGroupSize,
+			(height + kPyramidGroupSize - 1) / kPyramidGroupSize, 1);
+		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glDeleteProgram(program);
+	glDeleteTextures(1, &depth_texture);
+	CHECK(glGetError() == GL_NO_ERROR);
+
+	std::vector<float> expected = depth;
+	int width = kDepthWidth;
+	int height = kDepthHeight;
+	glBindTexture(GL_TEXTURE_2D, pyramid);
+	for (int level = 0; level < levels; level++)
+	{
+		if (level > 0)
+		{
+			const int target_width = std::max(1, width >> 1);
+			const int target_height = std::max(1, height >> 1);
+			std::vector<float> target(target_width * target_height, 0.f);
+			for (int y = 0; y < height; y++)
+			{
+				for (int x = 0; x < width; x++)
+				{
+					float& texel = target[std::min(y / 2, target_height - 1) * target_width
+						+ std::min(x / 2, target_width - 1)];
+					texel = std::max(texel, expected[y * width + x]);
+				}
+			}
+			expected.swap(target);
+			width = target_width;
+			height = target_height;
+		}
+
+		std::vector<float> gpu_level(width * height);
+		glGetTexImage(GL_TEXTURE_2D, level, GL_RED, GL_FLOAT, gpu_level.data());
+		CHECK(gpu_level == expected);
+	}
+	glBindTexture(GL_TEXTURE_2D, 0);
+	return pyramid;
+}
+
+// Culls against the pyramid and checks every instance that is in front of
+// the depth image somewhere inside its screen box still gets drawn, the
+// shader may keep more than that but never less
+static void checkOcclusion(GLuint program, const CullBuffers & buffers,
+	const std::vector<GpuInstance> & instances, const std::uint32_t (&material_offsets)[kMaterialCount])
+{
+	const Vec3 eye = { 0.f, 0.f, 0.f };
+	float view_projection[16];
+	viewProjection(eye, 0.f, view_projection);
+	Vec4 planes[6];
+	frustumPlanes(view_projection, planes);
+
+	const std::vector<float> depth = makeDepthImage(view_projection);
+	Occlusion occlusion = { true, view_projection, 0, 0 };
+	occlusion.pyramid = buildPyramid(depth, occlusion.levels);
+	if (occlusion.pyramid == 0)
+		return;
+
+	runCull(program, buffers, planes, eye, occlusion);
+	const std::vector<bool> drawn = commandedInstances(buffers, material_offsets);
+
+	int in_frustum = 0;
+	int visible = 0;
+	int drawn_count = 0;
+	int visible_culled = 0;
+	for (int i = 0; i < kInstanceCount; i++)
+	{
+		drawn_count += drawn[i] ? 1 : 0;
+
+		Vec3 centre;
+		float radius;
+		worldBounds(instances[i], centre, radius);
+		const float margin = 1e-3f * (radius + 1.f);
+		if (!isInsideFrustum(planes, centre, radius - margin))
+			continue;
+		in_frustum++;
+
+		// the box the shader projects, anything behind the eye is visible
+		Vec3 ndc_min = { 1.f, 1.f, 1.f };
+		Vec3 ndc_max = { -1.f, -1.f, -1.f };
+		bool in_front = true;
+		for (int corner = 0; corner < 8 && in_front; corner++)
+		{
+			const Vec3 point = { centre.x + ((corner & 1) ? radius : -radius),
+				centre.y + ((corner & 2) ? radius : -radius), centre.z + ((corner & 4) ? radius : -radius) };
+			Vec3 ndc;
+			in_front = project(view_projection, point, ndc);
+			ndc_min = { std::min(ndc_min.x, ndc.x), std::min(ndc_min.y, ndc.y), std::min(ndc_min.z, ndc.z) };
+			ndc_max = { std::max(ndc_max.x, ndc.x), std::max(ndc_max.y, ndc.y), std::max(ndc_max.z, ndc.z) };
+		}
+
+		bool can_be_seen = !in_front;
+		if (in_front)
+		{
+			// a pixel in from the edge of the box so rounding can't decide it
+			auto pixel = [](float ndc, int size)
+			{
+				return std::min(std::max((int)((std::min(std::max(ndc * 0.5f + 0.5f, 0.f), 1.f)) * size), 0), size - 1);
+			};
+			const int x0 = pixel(ndc_min.x, kDepthWidth) + 1;
+			const int x1 = pixel(ndc_max.x, kDepthWidth) - 1;
+			const int y0 = pixel(ndc_min.y, kDepthHeight) + 1;
+			const int y1 = pixel(ndc_max.y, kDepthHeight) - 1;
+			const float closest_depth = ndc_min.z * 0.5f + 0.5f;
+			for (int y = y0; y <= y1 && !can_be_seen; y++)
+			{
+				for (int x = x0; x <= x1 && !can_be_seen; x++)
+					can_be_seen = depth[y * kDepthWidth + x] > closest_depth + 1e-4f;
+			}
+		}
+		if (!can_be_seen)
+			continue;
+
+		visible++;
+		if (!drawn[i])
+		{
+			if (visible_culled++ == 0)
+				std::cerr << "instance " << i << " can be seen but was occlusion culled" << std::endl;
+		}
+	}
+
+	std::cout << "occlusion at " << kDepthWidth << "x" << kDepthHeight << " with " << occlusion.levels
+		<< " levels: " << in_frustum << " in the frustum, " << visible << " can be seen, GPU drew "
+		<< drawn_count << std::endl;
+	CHECK(visible > 0);
+	CHECK(visible_culled == 0);
+	// and the pyramid really was used
+	CHECK(drawn_count < in_frustum);
+
+	glDeleteTextures(1, &occlusion.pyramid);
+}
+
+// Draws whatever the last cull wrote through an instanced vertex attribute
+// the way GpuDrivenRenderer::bindGeometry sets it up. Every triangle of an
+// instance covers that instance's pixel of an integer target, so both ways
+// of drawing have to light exactly the pixels of the instances the commands
+// name, and the zeroed slots past each count none.
+static void checkDrawPaths(const CullBuffers & buffers, const GpuMesh (&meshes)[kMeshCount],
+	const std::uint32_t (&material_offsets)[kMaterialCount], const std::uint32_t (&material_sizes)[kMaterialCount])
+{
+	const std::string vertex_shader =
+		"#version 430\n"
+		"layout(location = 0) in uint instance_index;\n"
+		"void main(void)\n"
+		"{\n"
+		"	const vec2 corners[3] = vec2[3](vec2(-0.5, -0.5), vec2(1.5, -0.5), vec2(-0.5, 1.5));\n"
+		"	uvec2 target_size = uvec2(" + std::to_string(kTargetWidth) + ", " + std::to_string(kTargetHeight) + ");\n"
+		"	vec2 pixel = vec2(instance_index % target_size.x, instance_index / target_size.x);\n"
+		"	pixel += vec2(0.5) + corners[gl_VertexID % 3];\n"
+		"	gl_Position = vec4(pixel / vec2(target_size) * 2.0 - 1.0, 0.0, 1.0);\n"
+		"}\n";
+	const std::string fragment_shader =
+		"#version 430\n"
+		"layout(location = 0) out uint drawn;\n"
+		"void main(void)\n"
+		"{\n"
+		"	drawn = 1u;\n"
+		"}\n";
+	const GLuint program = linkProgram("draw path shaders", {
+		compileShader(GL_VERTEX_SHADER, "draw path vertex shader", vertex_shader),
+		compileShader(GL_FRAGMENT_SHADER, "draw path fragment shader", fragment_shader) });
+	CHECK(program != 0);
+	if (program == 0)
+		return;
+
+	// every triangle is the three corners in some order whatever the base vertex
+	std::vector<std::uint32_t> elements(meshes[kMeshCount - 1].first_index + meshes[kMeshCount - 1].index_count);
+	for (size_t i = 0; i < elements.size(); i++)
+		elements[i] = (std::uint32_t)(i % 3);
+	std::vector<std::uint32_t> instance_ids(kInstanceCount);
+	for (int i = 0; i < kInstanceCount; i++)
+		instance_ids[i] = i;
+
+	GLuint element_vbo = 0;
+	GLuint instance_id_vbo = 0;
+	GLuint vao = 0;
+	glGenBuffers(1, &element_vbo);
+	glGenBuffers(1, &instance_id_vbo);
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, element_vbo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, elements.size() * sizeof(std::uint32_t), elements.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, instance_id_vbo);
+	glBufferData(GL_ARRAY_BUFFER, instance_ids.size() * sizeof(std::uint32_t), instance_ids.data(), GL_STATIC_DRAW);
+	glEnableVertexAttribArray(0);
+	glVertexAttribIPointer(0, 1, GL_UNSIGNED_INT, sizeof(std::uint32_t), 0);
+	glVertexAttribDivisor(0, 1);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+	GLuint framebuffer = 0;
+	GLuint target = 0;
+	glGenRenderbuffers(1, &target);
+	glBindRenderbuffer(GL_RENDERBUFFER, target);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_R32UI, kTargetWidth, kTargetHeight);
+	glGenFramebuffers(1, &framebuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, target);
+	CHECK(glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	glViewport(0, 0, kTargetWidth, kTargetHeight);
+
+	const std::vector<bool> expected = commandedInstances(buffers, material_offsets);
+
+	auto multi_draw_count = (PFNGLMULTIDRAWELEMENTSINDIRECTCOUNTARBPROC)
+		eglGetProcAddress("glMultiDrawElementsIndirectCountARB");
+	const bool has_indirect_count = hasExtension("GL_ARB_indirect_parameters") && multi_draw_count != nullptr;
+	if (!has_indirect_count)
+		std::cout << "GL_ARB_indirect_parameters missing, only the fallback is drawn" << std::endl;
+
+	for (int path = has_indirect_count ? 0 : 1; path < 2; path++)
+	{
+		const GLuint clear[4] = { 0, 0, 0, 0 };
+		glClearBufferuiv(GL_COLOR, 0, clear);
+
+		// the same binds and calls as bindGeometry and drawMaterial
+		glUseProgram(program);
+		glBindVertexArray(vao);
+		glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffers.commands);
+		// the renderer only binds the parameter buffer when it draws with the
+		// count, Mesa drops plain multi draws past a point while one is bound
+		glBindBuffer(GL_PARAMETER_BUFFER_ARB, path == 0 ? buffers.counts : 0);
+		for (int material = 0; material < kMaterialCount; material++)
+		{
+			const GLsizei max_draws = material_sizes[material];
+			if (max_draws == 0)
+				continue;
+			const void * commands = (const void *)(std::uintptr_t)(material_offsets[material] * sizeof(DrawCommand));
+			if (path == 0)
+			{
+				multi_draw_count(GL_TRIANGLES, GL_UNSIGNED_INT, commands,
+					material * sizeof(std::uint32_t), max_draws, sizeof(DrawCommand));
+			}
+			else
+			{
+				glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, commands, max_draws, sizeof(DrawCommand));
+			}
+		}
+		CHECK(glGetError() == GL_NO_ERROR);
+
+		std::vector<GLuint> drawn(kTargetWidth * kTargetHeight);
+		glReadPixels(0, 0, kTargetWidth, kTargetHeight, GL_RED_INTEGER, GL_UNSIGNED_INT, drawn.data());
+		int mismatches = 0;
+		int drawn_count = 0;
+		for (int i = 0; i < kTargetWidth * kTargetHeight; i++)
+		{
+			const bool should_draw = i < kInstanceCount && expected[i];
+			drawn_count += drawn[i] != 0 ? 1 : 0;
+			mismatches += (drawn[i] != 0) != should_draw ? 1 : 0;
+		}
+		std::cout << (path == 0 ? "indirect count" : "multi draw indirect fallback") << " drew "
+			<< drawn_count << " instances" << std::endl;
+		CHECK(drawn_count > 0);
+		CHECK(mismatches == 0);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glBindVertexArray(0);
+	glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+	glBindBuffer(GL_PARAMETER_BUFFER_ARB, 0);
+	glDeleteFramebuffers(1, &framebuffer);
+	glDeleteRenderbuffers(1, &target);
+	glDeleteVertexArrays(1, &vao);
+	GLuint vbos[] = { element_vbo, instance_id_vbo };
+	glDeleteBuffers(2, vbos);
+	glDeleteProgram(program);
+}
+
+int main()
+{
+	if (!createContext())
+	{
+		std::cout << "No headless GL 4.3 context, skipping" << std::endl;
+		return kSkipped;
+	}
+	std::cout << "GL " << glGetString(GL_VERSION) << " on " << glGetString(GL_RENDERER) << std::endl;
+
+	const GLuint program = createComputeProgram("cull_cs.glsl");
+	CHECK(program != 0);
+	if (program == 0)
+		return 1;
+
+	GpuMesh meshes[kMeshCount];
+	for (int i = 0; i < kMeshCount; i++)
+	{
+		meshes[i].first_index = i * 300;
+		meshes[i].index_count = 36 + i * 6;
+		meshes[i].base_vertex = i * 100;
+		meshes[i].pad = 0;
+	}
+
+	// Instances scattered around the camera, plenty of them straddle the
+	// frustum planes
+	std::mt19937 random(1234);
+	std::uniform_real_distribution<float> position(-250.f, 250.f);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+	std::vector<GpuInstance> instances(kInstanceCount);
+	std::uint32_t material_sizes[kMaterialCount] = {};
+	for (auto& instance : instances)
+	{
+		std::memset(&instance, 0, sizeof(instance));
+		instance.mesh_index = random() % kMeshCount;
+		instance.material_index = random() % kMaterialCount;
+		material_sizes[instance.material_index]++;
+
+		const float angle = unit(random) * 6.2831853f;
+		const float scale[3] = { 0.5f + unit(random) * 3.f, 0.5f + unit(random) * 3.f, 0.5f + unit(random) * 3.f };
+		float* m = instance.model;
+		m[0] = std::cos(angle) * scale[0]; m[2] = -std::sin(angle) * scale[0];
+		m[5] = scale[1];
+		m[8] = std::sin(angle) * scale[2]; m[10] = std::cos(angle) * scale[2];
+		m[12] = position(random); m[13] = position(random) * 0.2f; m[14] = position(random);
+		m[15] = 1.f;
+
+		instance.bounds[0] = unit(random) - 0.5f;
+		instance.bounds[1] = unit(random) - 0.5f;
+		instance.bounds[2] = unit(random) - 0.5f;
+		instance.bounds[3] = 0.5f + unit(random) * 4.f;
+		instance.uv_density = 0.1f + unit(random);
+	}
+
+	std::uint32_t material_offsets[kMaterialCount] = {};
+	for (int i = 1; i < kMaterialCount; i++)
+		material_offsets[i] = material_offsets[i - 1] + material_sizes[i - 1];
+	for (auto& instance : instances)
+		instance.command_offset = material_offsets[instance.material_index];
+
+	CullBuffers buffers;
+	buffers.instances = createBuffer(instances.data(), instances.size() * sizeof(GpuInstance));
+	buffers.meshes = createBuffer(meshes, sizeof(meshes));
+	buffers.commands = createBuffer(nullptr, instances.size() * sizeof(DrawCommand));
+	buffers.counts = createBuffer(nullptr, (kMaterialCount + 1) * sizeof(std::uint32_t));
+	buffers.demand = createBuffer(nullptr, kMaterialCount * sizeof(std::uint32_t));
+
+	const Vec3 eyes[] = { { 0.f, 0.f, 0.f }, { 40.f, 10.f, -60.f }, { -120.f, -5.f, 80.f } };
+	const float yaws[] = { 0.f, 1.1f, -2.4f };
+	for (int view_index = 0; view_index < 3; view_index++)
+	{
+		float view_projection[16];
+		viewProjection(eyes[view_index], yaws[view_index], view_projection);
+		Vec4 planes[6];
+		frustumPlanes(view_projection, planes);
+
+		const Occlusion no_occlusion = { false, nullptr, 0, 0 };
+		runCull(program, buffers, planes, eyes[view_index], no_occlusion);
+
+		std::vector<std::uint32_t> gpu_counts(kMaterialCount + 1);
+		std::vector<DrawCommand> commands(kInstanceCount);
+		std::vector<std::uint32_t> demand(kMaterialCount);
+		readBuffer(buffers.counts, gpu_counts);
+		readBuffer(buffers.commands, commands);
+		readBuffer(buffers.demand, demand);
+
+		// Same tolerance as MyView::validateGpuCulling, an instance right on a
+		// plane can go either way
+		std::vector<std::uint32_t> certain(kMaterialCount + 1, 0);
+		std::vector<std::uint32_t> possible(kMaterialCount + 1, 0);
+		std::vector<bool> maybe_visible(kInstanceCount, false);
+		for (int i = 0; i < kInstanceCount; i++)
+		{
+			Vec3 centre;
+			float radius;
+			worldBounds(instances[i], centre, radius);
+			const float margin = 1e-3f * (radius + 1.f);
+			const std::uint32_t material = instances[i].material_index;
+			if (isInsideFrustum(planes, centre, radius - margin))
+			{
+				certain[material]++;
+				certain[kMaterialCount]++;
+			}
+			if (isInsideFrustum(planes, centre, radius + margin))
+			{
+				possible[material]++;
+				possible[kMaterialCount]++;
+				maybe_visible[i] = true;
+			}
+		}
+
+		std::cout << "view " << view_index << ": GPU drew " << gpu_counts[kMaterialCount]
+			<< ", CPU expected " << certain[kMaterialCount] << " to " << possible[kMaterialCount] << std::endl;
+		CHECK(certain[kMaterialCount] > 0);
+		CHECK(possible[kMaterialCount] < (std::uint32_t)kInstanceCount);
+
+		std::uint32_t material_total = 0;
+		for (int material = 0; material <= kMaterialCount; material++)
+		{
+			CHECK(gpu_counts[material] >= certain[material]);
+			CHECK(gpu_counts[material] <= possible[material]);
+			if (material < kMaterialCount)
+				material_total += gpu_counts[material];
+		}
+		CHECK(material_total == gpu_counts[kMaterialCount]);
+
+		// Every command the shader wrote draws a visible instance of its
+		// material's range with that instance's mesh, and no instance twice
+		std::vector<bool> drawn(kInstanceCount, false);
+		for (int material = 0; material < kMaterialCount; material++)
+		{
+			for (std::uint32_t slot = 0; slot < gpu_counts[material]; slot++)
+			{
+				const DrawCommand& command = commands[material_offsets[material] + slot];
+				CHECK(command.base_instance < (std::uint32_t)kInstanceCount);
+				if (command.base_instance >= (std::uint32_t)kInstanceCount)
+					continue;
+				const GpuInstance& instance = instances[command.base_instance];
+				const GpuMesh& mesh = meshes[instance.mesh_index];
+				CHECK(instance.material_index == (std::uint32_t)material);
+				CHECK(maybe_visible[command.base_instance]);
+				CHECK(!drawn[command.base_instance]);
+				CHECK(command.instance_count == 1);
+				CHECK(command.count == mesh.index_count);
+				CHECK(command.first_index == mesh.first_index);
+				CHECK(command.base_vertex == mesh.base_vertex);
+				drawn[command.base_instance] = true;
+			}
+
+			// materials with something on screen ask for a mip level
+			CHECK((gpu_counts[material] > 0) == (demand[material] != kNoDemand));
+		}
+	}
+
+	checkOcclusion(program, buffers, instances, material_offsets);
+	checkDrawPaths(buffers, meshes, material_offsets, material_sizes);
+
+	if (failures == 0)
+		std::cout << "GPU cull matches the CPU frustum and occlusion tests" << std::endl;
+	return failures == 0 ? 0 : 1;
+}
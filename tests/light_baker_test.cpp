@@ -0,0 +1,433 @@
+// Checks the light baker end to end. The SSE packet test has to agree with
+// the scalar one on random rays, then a small scene with an occluder is
+// baked through the public interface and every vertex compared with the
+// lighting worked out directly, which covers the BVH build and traversal and
+// how bakeWorker maps its chunks of vertices back to instances. Finally the
+// scene cache has to give back what was baked, be what a second run reads,
+// and be ignored once the lights change.
+
+#include "LightBaker.hpp"
+#include "TrianglePacket.hpp"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #condition << std::endl; \
+			failures++; \
+		} \
+	} while (false)
+
+static const char * const kCachePath = "light_baker_test.cache";
+
+// Where the irradiance starts in the cache file, after the magic, version,
+// key and vertex count
+static const std::streamoff kCacheHeaderSize = 4 + 4 + 8 + 4;
+
+// The occluder is a square this far either side of the origin at this height
+static const float kOccluderHalfSize = 3.f;
+static const float kOccluderHeight = 4.f;
+
+// Closer than this to a decision the float maths can go either way
+static const double kAmbiguous = 1e-4;
+
+struct Scene
+{
+	std::vector<LightBaker::Instance> instances;
+	std::vector<LightState> lights;
+	std::vector<std::vector<glm::vec3>> positions;
+	std::vector<std::vector<glm::vec3>> normals;
+	std::vector<std::vector<unsigned int>> elements;
+};
+
+// Double precision Moller-Trumbore against one lane of the packet, returns
+// -1 when the ray is too close to an edge or either end of the range to say
+static int referenceHit(const TrianglePacket & packet, int lane, const glm::vec3 & origin,
+	const glm::vec3 & direction, float max_distance)
+{
+	double v0[3], e1[3], e2[3], d[3], o[3];
+	for (int c = 0; c < 3; c++)
+	{
+		v0[c] = packet.v0[c][lane];
+		e1[c] = packet.edge1[c][lane];
+		e2[c] = packet.edge2[c][lane];
+		d[c] = direction[c];
+		o[c] = origin[c];
+	}
+	const double p[3] = { d[1] * e2[2] - d[2] * e2[1], d[2] * e2[0] - d[0] * e2[2], d[0] * e2[1] - d[1] * e2[0] };
+	const double det = e1[0] * p[0] + e1[1] * p[1] + e1[2] * p[2];
+	if (std::fabs(det) < kAmbiguous)
+		return std::fabs(det) == 0.0 ? 0 : -1;
+	const double t[3] = { o[0] - v0[0], o[1] - v0[1], o[2] - v0[2] };
+	const double u = (t[0] * p[0] + t[1] * p[1] + t[2] * p[2]) / det;
+	const double q[3] = { t[1] * e1[2] - t[2] * e1[1], t[2] * e1[0] - t[0] * e1[2], t[0] * e1[1] - t[1] * e1[0] };
+	const double v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) / det;
+	const double distance = (e2[0] * q[0] + e2[1] * q[1] + e2[2] * q[2]) / det;
+
+	const double margins[] = { u, v, 1.0 - u - v, distance, max_distance - distance };
+	bool hit = true;
+	for (double margin : margins)
+	{
+		if (std::fabs(margin) < kAmbiguous)
+			return -1;
+		hit = hit && margin > 0.0;
+	}
+	return hit ? 1 : 0;
+}
+
+static void checkPacketIntersection()
+{
+	std::mt19937 random(7);
+	std::uniform_real_distribution<float> coordinate(-1.f, 1.f);
+	std::uniform_real_distribution<float> unit(0.f, 1.f);
+
+	int rays = 0;
+	int hits = 0;
+	int skipped = 0;
+	int scalar_wrong = 0;
+	int sse_wrong = 0;
+	for (int packet_index = 0; packet_index < 2000; packet_index++)
+	{
+		// the last lanes are left zeroed now and then like a partly filled leaf
+		TrianglePacket packet;
+		std::memset(&packet, 0, sizeof(packet));
+		const int lanes = 1 + packet_index % 4;
+		for (int lane = 0; lane < lanes; lane++)
+		{
+			glm::vec3 vertices[3];
+			for (auto& vertex : vertices)
+				vertex = glm::vec3(coordinate(random), coordinate(random), coordinate(random));
+			for (int c = 0; c < 3; c++)
+			{
+				packet.v0[c][lane] = vertices[0][c];
+				packet.edge1[c][lane] = vertices[1][c] - vertices[0][c];
+				packet.edge2[c][lane] = vertices[2][c] - vertices[0][c];
+			}
+		}
+
+		for (int ray = 0; ray < 50; ray++)
+		{
+			// every other ray aims somewhere on one of the triangles so plenty hit
+			const glm::vec3 origin(coordinate(random) * 2.f, coordinate(random) * 2.f, coordinate(random) * 2.f);
+			glm::vec3 direction(coordinate(random), coordinate(random), coordinate(random));
+			if (ray % 2 == 0)
+			{
+				const int lane = random() % lanes;
+				float u = unit(random);
+				float v = unit(random);
+				if (u + v > 1.f)
+				{
+					u = 1.f - u;
+					v = 1.f - v;
+				}
+				for (int c = 0; c < 3; c++)
+				{
+					direction[c] = packet.v0[c][lane] + packet.edge1[c][lane] * u
+						+ packet.edge2[c][lane] * v - origin[c];
+				}
+			}
+			const float direction_length = glm::length(direction);
+			if (direction_length < 0.1f)
+				continue;
+			direction = direction / direction_length;
+			const float max_distance = 0.5f + unit(random) * 3.5f;
+
+			int expected = 0;
+			for (int lane = 0; lane < 4 && expected >= 0; lane++)
+			{
+				const int lane_hit = referenceHit(packet, lane, origin, direction, max_distance);
+				expected = lane_hit < 0 ? -1 : (expected | lane_hit);
+			}
+			if (expected < 0)
+			{
+				skipped++;
+				continue;
+			}
+
+			rays++;
+			hits += expected;
+			const bool scalar = intersectPacketScalar(packet, origin, direction, max_distance);
+			scalar_wrong += scalar != (expected != 0) ? 1 : 0;
+#ifdef TRIANGLE_PACKET_SSE
+			const bool sse = intersectPacketSse(packet, origin, direction, max_distance);
+			sse_wrong += sse != scalar ? 1 : 0;
+#endif
+		}
+	}
+
+#ifdef TRIANGLE_PACKET_SSE
+	std::cout << "SSE and scalar packet tests on " << rays << " rays, " << hits << " hits, "
+		<< skipped << " too close to call" << std::endl;
+#else
+	std::cout << "No SSE, scalar packet test on " << rays << " rays, " << hits << " hits" << std::endl;
+#endif
+	CHECK(hits > rays / 5);
+	CHECK(hits < rays * 4 / 5);
+	CHECK(scalar_wrong == 0);
+	CHECK(sse_wrong == 0);
+}
+
+// A flat grid in xz facing up, size by size vertices
+static void addFloor(Scene & scene, int size, float extent)
+{
+	std::vector<glm::vec3> positions;
+	std::vector<glm::vec3> normals;
+	std::vector<unsigned int> elements;
+	for (int z = 0; z < size; z++)
+	{
+		for (int x = 0; x < size; x++)
+		{
+			positions.push_back(glm::vec3(-extent + 2.f * extent * x / (size - 1), 0.f,
+				-extent + 2.f * extent * z / (size - 1)));
+			normals.push_back(glm::vec3(0.f, 1.f, 0.f));
+		}
+	}
+	for (int z = 0; z + 1 < size; z++)
+	{
+		for (int x = 0; x + 1 < size; x++)
+		{
+			const unsigned int corner = z * size + x;
+			const unsigned int quad[6] = { corner, corner + size, corner + 1,
+				corner + 1, corner + size, corner + size + 1 };
+			elements.insert(elements.end(), quad, quad + 6);
+		}
+	}
+	scene.positions.push_back(positions);
+	scene.normals.push_back(normals);
+	scene.elements.push_back(elements);
+}
+
+static LightBaker::Instance makeInstance(int mesh_index, const glm::vec3 & translation)
+{
+	LightBaker::Instance instance;
+	instance.mesh_index = mesh_index;
+	instance.xform[0] = glm::vec3(1.f, 0.f, 0.f);
+	instance.xform[1] = glm::vec3(0.f, 1.f, 0.f);
+	instance.xform[2] = glm::vec3(0.f, 0.f, 1.f);
+	instance.xform[3] = translation;
+	return instance;
+}
+
+// Two floors with different vertex counts, the first 256 vertices so a
+// chunk starts exactly where it ends and on the instance without a mesh
+// that follows it. A square over the first floor facing down shadows it.
+static Scene makeScene()
+{
+	Scene scene;
+	addFloor(scene, 16, 10.f);
+	addFloor(scene, 17, 10.f);
+
+	const float s = kOccluderHalfSize;
+	scene.positions.push_back({ glm::vec3(-s, 0.f, -s), glm::vec3(s, 0.f, -s), glm::vec3(-s, 0.f, s), glm::vec3(s, 0.f, s) });
+	scene.normals.push_back(std::vector<glm::vec3>(4, glm::vec3(0.f, -1.f, 0.f)));
+	scene.elements.push_back({ 0, 1, 2, 2, 1, 3 });
+
+	scene.instances.push_back(makeInstance(0, glm::vec3(0.f, 0.f, 0.f)));
+	scene.instances.push_back(makeInstance(-1, glm::vec3(0.f, 0.f, 0.f)));
+	scene.instances.push_back(makeInstance(1, glm::vec3(25.f, 0.f, 0.f)));
+	scene.instances.push_back(makeInstance(2, glm::vec3(0.f, kOccluderHeight, 0.f)));
+	scene.instances.push_back(makeInstance(0, glm::vec3(0.f, 0.f, -25.f)));
+
+	LightState above;
+	above.position = glm::vec3(0.5f, 10.f, 0.25f);
+	above.intensity = glm::vec3(1.f, 0.5f, 0.25f);
+	above.range = 40.f;
+	LightState aside;
+	aside.position = glm::vec3(25.f, 8.f, -12.f);
+	aside.intensity = glm::vec3(0.f, 1.f, 0.f);
+	aside.range = 25.f;
+	scene.lights.push_back(above);
+	scene.lights.push_back(aside);
+	return scene;
+}
+
+// Where the segment from position to the light crosses the occluder's
+// plane, -1 if it misses the square, 1 if it goes through it and 0 when it
+// passes too close to an edge to say
+static int shadowedByOccluder(const glm::vec3 & position, const glm::vec3 & light)
+{
+	if ((position.y - kOccluderHeight) * (light.y - kOccluderHeight) >= 0.f)
+		return -1;
+	const float t = (kOccluderHeight - position.y) / (light.y - position.y);
+	const float x = position.x + (light.x - position.x) * t;
+	const float z = position.z + (light.z - position.z) * t;
+	const float inside = std::min(kOccluderHalfSize - std::fabs(x), kOccluderHalfSize - std::fabs(z));
+	if (std::fabs(inside) < 0.05f)
+		return 0;
+	return inside > 0.f ? 1 : -1;
+}
+
+static bool waitForBake(LightBaker & baker)
+{
+	const auto give_up = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+	while (!baker.isFinished())
+	{
+		if (std::chrono::steady_clock::now() > give_up)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+static bool bake(LightBaker & baker, const Scene & scene)
+{
+	for (size_t i = 0; i < scene.positions.size(); i++)
+		baker.addMesh(scene.positions[i], scene.normals[i], scene.elements[i]);
+	baker.start(scene.instances, scene.lights, kCachePath);
+	const bool finished = waitForBake(baker);
+	CHECK(finished);
+	return finished;
+}
+
+// Compares every vertex with the lighting worked out without the baker,
+// the same sums as bakeVertex with the occluder test done analytically
+static void checkIrradiance(const LightBaker & baker, const Scene & scene)
+{
+	const auto& offsets = baker.instanceOffsets();
+	const auto& irradiance = baker.irradiance();
+	CHECK(offsets.size() == scene.instances.size());
+	if (offsets.size() != scene.instances.size())
+		return;
+
+	std::uint32_t vertex_count = 0;
+	int checked = 0;
+	int shadowed = 0;
+	int wrong = 0;
+	for (size_t i = 0; i < scene.instances.size(); i++)
+	{
+		const LightBaker::Instance& instance = scene.instances[i];
+		CHECK(offsets[i] == vertex_count);
+		if (instance.mesh_index < 0)
+			continue;
+
+		const auto& positions = scene.positions[instance.mesh_index];
+		const auto& normals = scene.normals[instance.mesh_index];
+		for (size_t v = 0; v < positions.size(); v++)
+		{
+			const glm::vec3 position = positions[v] + instance.xform[3];
+			const glm::vec3 normal = normals[v];
+
+			glm::vec3 expected(0.f);
+			bool ambiguous = false;
+			bool in_shadow = false;
+			for (const auto& light : scene.lights)
+			{
+				const glm::vec3 to_light = light.position - position;
+				const float light_distance = glm::length(to_light);
+				const glm::vec3 L = to_light / light_distance;
+				const float diffuse_intensity = glm::dot(L, normal);
+				const float attenuation = glm::smoothstep(light.range, light.range / 2, light_distance);
+				if (light_distance >= light.range || diffuse_intensity <= 0.f || attenuation <= 0.f)
+					continue;
+
+				const int shadow = shadowedByOccluder(position, light.position);
+				ambiguous = ambiguous || shadow == 0;
+				if (shadow > 0)
+				{
+					in_shadow = true;
+					continue;
+				}
+				expected += light.intensity * diffuse_intensity * attenuation;
+			}
+			if (ambiguous)
+				continue;
+
+			const glm::vec4& baked = irradiance[vertex_count + v];
+			const float error = std::fabs(baked.x - expected.x) + std::fabs(baked.y - expected.y)
+				+ std::fabs(baked.z - expected.z);
+			if (error > 1e-4f)
+			{
+				if (wrong++ == 0)
+				{
+					std::cerr << "instance " << i << " vertex " << v << " baked " << baked.x << " "
+						<< baked.y << " " << baked.z << ", expected " << expected.x << " "
+						<< expected.y << " " << expected.z << std::endl;
+				}
+			}
+			checked++;
+			shadowed += in_shadow ? 1 : 0;
+		}
+		vertex_count += (std::uint32_t)positions.size();
+	}
+
+	std::cout << "checked " << checked << " of " << vertex_count << " vertices, "
+		<< shadowed << " in the occluder's shadow" << std::endl;
+	CHECK(irradiance.size() == vertex_count);
+	CHECK(checked > (int)vertex_count * 9 / 10);
+	CHECK(shadowed > 10);
+	CHECK(wrong == 0);
+}
+
+static void checkBakeAndCache()
+{
+	std::remove(kCachePath);
+	Scene scene = makeScene();
+
+	// nothing cached yet, this one builds the BVH and traces
+	std::vector<glm::vec4> baked;
+	{
+		LightBaker baker;
+		if (!bake(baker, scene))
+			return;
+		checkIrradiance(baker, scene);
+		baked = baker.irradiance();
+	}
+	CHECK(std::ifstream(kCachePath, std::ios::binary).good());
+
+	// the same scene again reads the cache and gets the same values
+	{
+		LightBaker baker;
+		if (!bake(baker, scene))
+			return;
+		CHECK(baker.irradiance().size() == baked.size());
+		CHECK(std::memcmp(baker.irradiance().data(), baked.data(), baked.size() * sizeof(glm::vec4)) == 0);
+	}
+
+	// and really does take them from the file
+	const float marker = 12345.f;
+	{
+		std::fstream file(kCachePath, std::ios::binary | std::ios::in | std::ios::out);
+		file.seekp(kCacheHeaderSize);
+		file.write((const char *)&marker, sizeof(marker));
+		CHECK(file.good());
+	}
+	{
+		LightBaker baker;
+		if (!bake(baker, scene))
+			return;
+		CHECK(!baker.irradiance().empty() && baker.irradiance()[0].x == marker);
+	}
+
+	// a light that has moved doesn't match the cached key, so it bakes again
+	scene.lights[0].position = glm::vec3(-0.75f, 9.f, 0.5f);
+	{
+		LightBaker baker;
+		if (!bake(baker, scene))
+			return;
+		CHECK(!baker.irradiance().empty() && baker.irradiance()[0].x != marker);
+		checkIrradiance(baker, scene);
+	}
+
+	std::remove(kCachePath);
+}
+
+int main()
+{
+	checkPacketIntersection();
+	checkBakeAndCache();
+
+	if (failures == 0)
+		std::cout << "Light baker matches the reference" << std::endl;
+	return failures == 0 ? 0 : 1;
+}